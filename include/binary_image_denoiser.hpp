@@ -1,11 +1,100 @@
 #ifndef MAXFLOW_IMAGE_DENOISING_BINARY_IMAGE_DENOISER_HPP
 #define MAXFLOW_IMAGE_DENOISING_BINARY_IMAGE_DENOISER_HPP
 
+#include <cstddef>
+#include <filesystem>
 #include <memory>
+#include <optional>
+#include <vector>
 
 #include "types.hpp"
 
 class GreyscaleImage;
+class MultiChannelImage;
+
+/// \brief Tuning options of the BinaryImageDenoiser.
+struct DenoiserOptions
+{
+  /// \brief Order in which pixels are numbered as graph vertices.
+  /// \details Tiled and Z-order numberings keep vertical neighbours
+  /// close in memory, which may reduce cache misses for wide images.
+  /// The effect depends on the image: Z-order numbering can be slower
+  /// than the row-major one.
+  VertexOrdering vertex_ordering = VertexOrdering::row_major;
+
+  /// \brief Maximum number of bytes the denoiser may allocate,
+  /// or no limit if empty.
+  ///
+  /// \details
+  /// The budget is checked against BinaryImageDenoiser::estimate_memory
+  /// before anything is allocated.
+  /// The construction fails with an exception
+  /// if a single channel cannot be solved within the budget.
+  /// Multi-channel images are solved with fewer channels in parallel
+  /// if all of them do not fit into the budget at once.
+  std::optional<std::size_t> memory_budget;
+
+  /// \brief Whether to collapse the regions with provably fixed labels
+  /// into the source and the sink before solving.
+  ///
+  /// \details
+  /// Uniform regions whose pixels prefer their values strongly enough
+  /// to outweigh the discontinuity penalties on the region boundary
+  /// keep their values in every optimal labelling.
+  /// They are removed from the graph and act as fixed labels
+  /// for the neighbouring pixels, so the graph size tracks
+  /// the image complexity rather than the resolution.
+  /// The result is still an optimal labelling.
+  ///
+  /// The graph is built for each image channel,
+  /// so it pays off for mostly uniform images.
+  /// A channel is collapsed only if that needs no more memory
+  /// than the solver state of its whole graph.
+  /// The other channels solve the whole graph,
+  /// whose edges are built once and shared by them,
+  /// so collapsing never needs more memory than solving without it,
+  /// for any number of channels.
+  bool collapse_fixed_regions = false;
+
+  /// \brief Whether to check the consistency of all arrays
+  /// of a topology file when loading it.
+  ///
+  /// \details
+  /// By default, only the header and the file size are checked,
+  /// so loading takes constant time and does not read the arrays.
+  /// The full check reads the whole file once,
+  /// for example about 0.4 s for a 900 MB file in the page cache.
+  /// Use it once for files from untrusted sources before relying on them.
+  /// It only applies to a denoiser constructed from a topology file.
+  bool verify_topology = false;
+};
+
+/// \brief Memory required by a BinaryImageDenoiser, in bytes.
+struct MemoryEstimate
+{
+  /// \brief Graph topology shared by all channels.
+  /// \details When collapsing fixed regions, its edges are only built
+  /// if a channel cannot be collapsed.
+  std::size_t topology;
+  /// \brief Edge capacities and Max-Flow state of a channel being solved.
+  std::size_t solver;
+  /// \brief Labels of a solved channel.
+  std::size_t labels;
+
+  /// \brief Total memory to solve the given number of channels in parallel.
+  [[nodiscard]] std::size_t total(PixelValue channels_count = 1) const;
+};
+
+/// \brief A rectangular region of an image.
+struct ImageRegion
+{
+  /// \brief Top row of the region.
+  ImageSize y;
+  /// \brief Leftmost column of the region.
+  ImageSize x;
+  ImageSize height;
+  ImageSize width;
+};
 
 /// \class BinaryImageDenoiser
 /// \brief The BinaryImageDenoiser class solves the maximum flow problem
@@ -33,10 +122,74 @@ public:
   /// \param height Input image(s) height.
   /// \param width Input image(s) width.
   /// \param discontinuity_penalty Smoothness term for the denoising problem.
+  /// \param options Tuning options of the solver.
+  BinaryImageDenoiser(
+    ImageSize height,
+    ImageSize width,
+    DiscontinuityPenalty discontinuity_penalty,
+    const DenoiserOptions& options = {});
+
+  /// \brief Construct a new denoiser
+  /// that only denoises the masked pixels of images.
+  ///
+  /// \details
+  /// The graph contains vertices only for the masked pixels,
+  /// so the memory and the solving time scale with the masked area.
+  /// Pixels outside the mask are left untouched,
+  /// and their binarised values act as fixed labels
+  /// for the neighbouring masked pixels.
+  ///
+  /// \param mask Image of the input image(s) size.
+  /// Pixels with non-zero values are denoised.
+  /// \param discontinuity_penalty Smoothness term for the denoising problem.
+  /// \param options Tuning options of the solver.
+  BinaryImageDenoiser(
+    const GreyscaleImage& mask,
+    DiscontinuityPenalty discontinuity_penalty,
+    const DenoiserOptions& options = {});
+
+  /// \brief Construct a new denoiser
+  /// that only denoises the given regions of images.
+  ///
+  /// \details
+  /// The graph contains vertices only for the pixels inside the regions,
+  /// so the memory and the solving time scale with the regions area.
+  /// Pixels outside the regions are left untouched,
+  /// and their binarised values act as fixed labels
+  /// for the neighbouring pixels inside the regions.
+  ///
+  /// \param height Input image(s) height.
+  /// \param width Input image(s) width.
+  /// \param regions Regions to denoise. They may overlap.
+  /// \param discontinuity_penalty Smoothness term for the denoising problem.
+  /// \param options Tuning options of the solver.
   BinaryImageDenoiser(
     ImageSize height,
     ImageSize width,
-    DiscontinuityPenalty discontinuity_penalty);
+    const std::vector<ImageRegion>& regions,
+    DiscontinuityPenalty discontinuity_penalty,
+    const DenoiserOptions& options = {});
+
+  /// \brief Construct a new denoiser on a precomputed graph topology.
+  ///
+  /// \details
+  /// The topology file is memory-mapped read-only,
+  /// so construction does not rebuild the graph,
+  /// and processes using the same file share its memory.
+  /// Only the edge capacities and the solver state are allocated.
+  ///
+  /// \param topology_path The path to a file
+  /// written by BinaryImageDenoiser::save_topology.
+  /// The image size, the vertex ordering, and the mask are taken from it.
+  /// \param discontinuity_penalty Smoothness term for the denoising problem.
+  /// \param options Tuning options of the solver.
+  /// The vertex ordering only applies to collapsed graphs.
+  /// The arrays of the file are only checked
+  /// if DenoiserOptions::verify_topology is set.
+  BinaryImageDenoiser(
+    const std::filesystem::path& topology_path,
+    DiscontinuityPenalty discontinuity_penalty,
+    const DenoiserOptions& options = {});
 
   BinaryImageDenoiser(const BinaryImageDenoiser&) = delete;
 
@@ -54,6 +207,49 @@ public:
   /// \note The noisy_image will be modified in-place with the result of the Max-Flow algorithm.
   void operator()(GreyscaleImage& noisy_image) const;
 
+  /// \brief Applies the Max-Flow algorithm to each channel
+  /// of the provided noisy image.
+  ///
+  /// \param noisy_image The image to denoise.
+  ///
+  /// \details The channels share the graph topology
+  /// and are solved in parallel, as many at once as the memory budget allows.
+  ///
+  /// \note The noisy_image will be modified in-place with the result of the Max-Flow algorithm.
+  void operator()(MultiChannelImage& noisy_image) const;
+
+  /// \brief Write the graph topology to a versioned binary file.
+  ///
+  /// \param path The path to the topology file.
+  ///
+  /// \note The file is platform-specific.
+  /// It can only be read on machines with the same byte order.
+  void save_topology(const std::filesystem::path& path) const;
+
+  /// \brief Estimate the memory needed to denoise images
+  /// of specific height and width.
+  ///
+  /// \details
+  /// The estimate is computed from the sizes of the vertex and edge properties
+  /// of the graph and the solver without allocating them.
+  /// Masks, regions, and collapsed regions only reduce the graph size,
+  /// so the estimate is an upper bound for them.
+  ///
+  /// \param height Input image(s) height.
+  /// \param width Input image(s) width.
+  /// \param options Tuning options the denoiser would be constructed with.
+  [[nodiscard]] static MemoryEstimate estimate_memory(
+    ImageSize height, ImageSize width, const DenoiserOptions& options = {});
+
+  /// \brief Get the peak memory allocated by the denoiser, in bytes.
+  ///
+  /// \details
+  /// The peak is measured from the allocated graph and solver arrays
+  /// since the construction.
+  /// A memory-mapped topology is not counted,
+  /// since its pages are shared by all processes mapping the file.
+  [[nodiscard]] std::size_t peak_memory() const;
+
   ~BinaryImageDenoiser();
 
 private:
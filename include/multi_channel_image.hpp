@@ -0,0 +1,66 @@
+#ifndef MAXFLOW_IMAGE_DENOISING_MULTI_CHANNEL_IMAGE_HPP
+#define MAXFLOW_IMAGE_DENOISING_MULTI_CHANNEL_IMAGE_HPP
+
+#include "types.hpp"
+
+#include <filesystem>
+#include <memory>
+
+namespace cv
+{
+  /// \brief Forward declaration of OpenCV's cv::Mat class.
+  class Mat;
+}
+
+/// \class MultiChannelImage
+/// \brief A class for representing and manipulating 8-bit images
+/// with an arbitrary number of channels.
+///
+/// \details
+/// The MultiChannelImage class provides functionality
+/// for loading, saving, accessing, and modifying each channel of an image
+/// independently, e.g. the colour channels of a scan.
+/// It uses OpenCV's cv::Mat class to handle image data.
+class MultiChannelImage
+{
+public:
+  /// \brief Construct a new MultiChannelImage object from an image file.
+  ///
+  /// \param path The path to the image file.
+  ///
+  /// \note The channels are kept as stored in the file,
+  /// but the values are converted to 8 bits.
+  explicit MultiChannelImage(const std::filesystem::path& path);
+
+  /// \brief Load an image from the specified path.
+  ///
+  /// \param path The path of the image to be loaded.
+  ///
+  /// \note The channels are kept as stored in the file,
+  /// but the values are converted to 8 bits.
+  void load(const std::filesystem::path& path);
+
+  /// \brief Save the image to the specified path.
+  ///
+  /// \param path The path to save the image.
+  /// File extension defines the output format.
+  void save(const std::filesystem::path& path) const;
+
+  [[nodiscard]] ImageSize height() const;
+
+  [[nodiscard]] ImageSize width() const;
+
+  [[nodiscard]] PixelValue channels() const;
+
+  [[nodiscard]] PixelValue operator()(
+    ImageSize y, ImageSize x, PixelValue channel) const;
+
+  PixelValue& operator()(ImageSize y, ImageSize x, PixelValue channel);
+
+  ~MultiChannelImage();
+
+private:
+  std::unique_ptr<cv::Mat> image;
+};
+
+#endif //MAXFLOW_IMAGE_DENOISING_MULTI_CHANNEL_IMAGE_HPP
@@ -22,4 +22,21 @@ using DiscontinuityPenalty = std::uint32_t;
 /// which cannot exceed the sum of all edge capacities.
 using EdgeCapacity = std::uint64_t;
 
+/// \brief Order in which pixels are numbered as graph vertices.
+/// \details Vertex and edge properties are stored in vertex order,
+/// so the numbering defines how far apart neighbouring pixels are in memory.
+enum class VertexOrdering : std::uint8_t
+{
+  /// \brief Pixel (y, x) is vertex y * width + x.
+  /// Vertical neighbours are a full image row apart.
+  row_major,
+  /// \brief Square tiles are numbered row-major,
+  /// and pixels within each tile are numbered row-major too.
+  /// Vertical neighbours are at most a tile row apart.
+  tiled,
+  /// \brief Pixels are numbered along the Z-order (Morton) curve
+  /// with indices compacted to skip positions outside the image.
+  z_order,
+};
+
 #endif //MAXFLOW_IMAGE_DENOISING_TYPES_HPP
@@ -1,16 +1,108 @@
 #include "binary_image_denoiser.hpp"
 
 #include "max_flow_denoiser.hpp"
+#include "max_flow_exceptions.hpp"
 
 #include <memory>
+#include <string>
+#include <vector>
+
+using namespace std::string_literals;
+
+namespace
+{
+  std::vector<bool> image_mask(const GreyscaleImage& mask)
+  {
+    std::vector<bool> pixel_mask(
+      static_cast<VertexCount>(mask.height()) * mask.width());
+    for (ImageSize y = 0; y < mask.height(); ++y)
+    {
+      for (ImageSize x = 0; x < mask.width(); ++x)
+      {
+        pixel_mask[static_cast<VertexCount>(y) * mask.width() + x] =
+          mask(y, x) != 0;
+      }
+    }
+    return pixel_mask;
+  }
+
+  std::vector<bool> regions_mask(
+    const ImageSize height,
+    const ImageSize width,
+    const std::vector<ImageRegion>& regions)
+  {
+    std::vector<bool> pixel_mask(static_cast<VertexCount>(height) * width);
+    for (const auto& region : regions)
+    {
+      if (region.y + region.height > height or region.x + region.width > width)
+      {
+        throw EdgeInitialisationException{
+          "Region of size "s + std::to_string(region.height) + "x"s +
+          std::to_string(region.width) + " at ("s + std::to_string(region.y) +
+          ", "s + std::to_string(region.x) + ") exceeds the image of size "s +
+          std::to_string(height) + "x"s + std::to_string(width)
+        };
+      }
+      for (VertexCount y = region.y; y < region.y + region.height; ++y)
+      {
+        for (VertexCount x = region.x; x < region.x + region.width; ++x)
+        {
+          pixel_mask[y * width + x] = true;
+        }
+      }
+    }
+    return pixel_mask;
+  }
+}
+
+BinaryImageDenoiser::BinaryImageDenoiser(
+  const ImageSize height,
+  const ImageSize width,
+  const DiscontinuityPenalty discontinuity_penalty,
+  const DenoiserOptions& options)
+  : implementation{
+    std::make_unique<MaxFlowDenoiser>(
+      height, width, discontinuity_penalty, options, std::vector<bool>{}
+    )
+  }
+{
+}
+
+BinaryImageDenoiser::BinaryImageDenoiser(
+  const GreyscaleImage& mask,
+  const DiscontinuityPenalty discontinuity_penalty,
+  const DenoiserOptions& options)
+  : implementation{
+    std::make_unique<MaxFlowDenoiser>(
+      mask.height(), mask.width(), discontinuity_penalty, options,
+      image_mask(mask)
+    )
+  }
+{
+}
 
 BinaryImageDenoiser::BinaryImageDenoiser(
   const ImageSize height,
   const ImageSize width,
-  const DiscontinuityPenalty discontinuity_penalty)
+  const std::vector<ImageRegion>& regions,
+  const DiscontinuityPenalty discontinuity_penalty,
+  const DenoiserOptions& options)
+  : implementation{
+    std::make_unique<MaxFlowDenoiser>(
+      height, width, discontinuity_penalty, options,
+      regions_mask(height, width, regions)
+    )
+  }
+{
+}
+
+BinaryImageDenoiser::BinaryImageDenoiser(
+  const std::filesystem::path& topology_path,
+  const DiscontinuityPenalty discontinuity_penalty,
+  const DenoiserOptions& options)
   : implementation{
     std::make_unique<MaxFlowDenoiser>(
-      height, width, discontinuity_penalty
+      topology_path, discontinuity_penalty, options
     )
   }
 {
@@ -22,6 +114,35 @@ void BinaryImageDenoiser::operator()(GreyscaleImage& noisy_image) const
   (*implementation) >> noisy_image;
 }
 
+void BinaryImageDenoiser::operator()(MultiChannelImage& noisy_image) const
+{
+  (*implementation)(noisy_image);
+  (*implementation) >> noisy_image;
+}
+
+void BinaryImageDenoiser::save_topology(const std::filesystem::path& path) const
+{
+  implementation->save_topology(path);
+}
+
+MemoryEstimate BinaryImageDenoiser::estimate_memory(
+  const ImageSize height,
+  const ImageSize width,
+  const DenoiserOptions&)
+{
+  return MaxFlowDenoiser::estimate_memory(height, width, std::vector<bool>{});
+}
+
+std::size_t BinaryImageDenoiser::peak_memory() const
+{
+  return implementation->peak_memory();
+}
+
+std::size_t MemoryEstimate::total(const PixelValue channels_count) const
+{
+  return this->topology + channels_count * (this->solver + this->labels);
+}
+
 BinaryImageDenoiser::BinaryImageDenoiser(BinaryImageDenoiser&&) noexcept = default;
 
 BinaryImageDenoiser& BinaryImageDenoiser::operator=(BinaryImageDenoiser&&) noexcept = default;
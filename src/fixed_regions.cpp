@@ -0,0 +1,227 @@
+#include "fixed_regions.hpp"
+
+#include "vertex_ordering.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <limits>
+
+namespace
+{
+  /// \brief Balance of a pixel or a flow between neighbouring pixels.
+  /// \details Must be able to represent
+  /// four discontinuity penalties with a sign.
+  using Balance = std::int64_t;
+
+  /// \brief Get the binarised label of a pixel value.
+  bool pixel_label(const PixelValue value)
+  {
+    return value > std::numeric_limits<PixelValue>::max() / 2;
+  }
+
+  /// \brief Get how much a pixel prefers its binarised label to the other one.
+  Balance pixel_gain(const PixelValue value)
+  {
+    const auto& max_value = Balance{std::numeric_limits<PixelValue>::max()};
+    return pixel_label(value) ? 2 * value - max_value : max_value - 2 * value;
+  }
+}
+
+std::vector<bool> find_unfixed_pixels(
+  const GridTopology& topology,
+  const EdgeCapacity discontinuity_penalty,
+  const std::vector<PixelValue>& pixels)
+{
+  const VertexCount rows = topology.height();
+  const VertexCount columns = topology.width();
+  const auto& penalty = static_cast<Balance>(discontinuity_penalty);
+
+  const auto& in_graph = [&topology, columns](const VertexCount pixel)
+  {
+    return topology.pixel_vertex(
+      static_cast<ImageSize>(pixel / columns),
+      static_cast<ImageSize>(pixel % columns)
+    ) != no_vertex;
+  };
+
+  // All pixels in the graph start as fixed candidates,
+  // and pixels outside the graph are fixed anyway.
+  std::vector<bool> unfixed(pixels.size());
+  std::vector<Balance> balances(pixels.size());
+  // Flows from each pixel to its right and bottom neighbours.
+  std::vector<Balance> right_flows(pixels.size());
+  std::vector<Balance> down_flows(pixels.size());
+  std::vector<bool> queued(pixels.size());
+  std::vector<VertexCount> queue;
+
+  const auto& for_each_neighbour =
+    [rows, columns](const VertexCount pixel, const auto& visit)
+    {
+      const auto& y = pixel / columns;
+      const auto& x = pixel % columns;
+      if (x + 1 < columns)
+      {
+        visit(pixel + 1);
+      }
+      if (x > 0)
+      {
+        visit(pixel - 1);
+      }
+      if (y + 1 < rows)
+      {
+        visit(pixel + columns);
+      }
+      if (y > 0)
+      {
+        visit(pixel - columns);
+      }
+    };
+
+  // Balance passed to the right or the bottom neighbour
+  // along the edge between the pixels.
+  const auto& stored_flow = [&, columns](
+    const VertexCount from, const VertexCount to) -> Balance&
+  {
+    if (to == from + 1)
+    {
+      return right_flows[from];
+    }
+    if (to == from + columns)
+    {
+      return down_flows[from];
+    }
+    return to + 1 == from ? right_flows[to] : down_flows[to];
+  };
+  // Balance passed from one pixel to its neighbour.
+  const auto& passed = [&](const VertexCount from, const VertexCount to)
+  {
+    const auto& value = stored_flow(from, to);
+    return to == from + 1 or to == from + columns ? value : -value;
+  };
+  const auto& pass = [&](
+    const VertexCount from, const VertexCount to, const Balance amount)
+  {
+    if (to == from + 1 or to == from + columns)
+    {
+      stored_flow(from, to) += amount;
+    }
+    else
+    {
+      stored_flow(from, to) -= amount;
+    }
+  };
+
+  const auto& is_candidate = [&](const VertexCount pixel)
+  {
+    return in_graph(pixel) and !unfixed[pixel];
+  };
+  // A neighbour agrees with a candidate if it is a candidate
+  // with the same label or a pixel outside the graph with the same label.
+  const auto& agrees = [&](const VertexCount pixel, const VertexCount neighbour)
+  {
+    return pixel_label(pixels[pixel]) == pixel_label(pixels[neighbour]) and
+           (!in_graph(neighbour) or !unfixed[neighbour]);
+  };
+  const auto& enqueue = [&](const VertexCount pixel)
+  {
+    if (!queued[pixel] and balances[pixel] <= 0)
+    {
+      queued[pixel] = true;
+      queue.push_back(pixel);
+    }
+  };
+
+  for (VertexCount pixel = 0; pixel < pixels.size(); ++pixel)
+  {
+    if (!in_graph(pixel))
+    {
+      continue;
+    }
+    balances[pixel] = pixel_gain(pixels[pixel]);
+    for_each_neighbour(
+      pixel,
+      [&](const VertexCount neighbour)
+      {
+        if (!agrees(pixel, neighbour))
+        {
+          balances[pixel] -= penalty;
+        }
+      }
+    );
+    enqueue(pixel);
+  }
+
+  while (!queue.empty())
+  {
+    const auto pixel = queue.back();
+    queue.pop_back();
+    queued[pixel] = false;
+    if (!is_candidate(pixel) or balances[pixel] > 0)
+    {
+      continue;
+    }
+
+    // Borrow the balance from neighbours of the same region
+    // as long as they stay positive.
+    for_each_neighbour(
+      pixel,
+      [&](const VertexCount neighbour)
+      {
+        if (balances[pixel] > 0 or !is_candidate(neighbour) or
+            !agrees(pixel, neighbour))
+        {
+          return;
+        }
+        const auto& amount = std::min({
+          penalty - passed(neighbour, pixel),
+          balances[neighbour] - 1,
+          1 - balances[pixel]
+        });
+        if (amount > 0)
+        {
+          pass(neighbour, pixel, amount);
+          balances[neighbour] -= amount;
+          balances[pixel] += amount;
+        }
+      }
+    );
+    if (balances[pixel] > 0)
+    {
+      continue;
+    }
+
+    // The pixel cannot be certified, so it leaves its region.
+    // Its neighbours in the region take back the flows they passed to it
+    // and may now disagree with it.
+    unfixed[pixel] = true;
+    for_each_neighbour(
+      pixel,
+      [&](const VertexCount neighbour)
+      {
+        if (!is_candidate(neighbour) or
+            pixel_label(pixels[pixel]) != pixel_label(pixels[neighbour]))
+        {
+          return;
+        }
+        balances[neighbour] += passed(neighbour, pixel) - penalty;
+        pass(neighbour, pixel, -passed(neighbour, pixel));
+        enqueue(neighbour);
+      }
+    );
+  }
+
+  return unfixed;
+}
+
+std::size_t estimate_fixed_regions_memory_size(
+  const ImageSize height, const ImageSize width)
+{
+  // Pixel values, balances, flows, and the queue of pixels,
+  // as well as the unfixed and the queued flags packed into words.
+  constexpr std::size_t word_bits = sizeof(std::size_t) * CHAR_BIT;
+  const auto& pixels_count = static_cast<std::size_t>(height) * width;
+  return pixels_count *
+         (sizeof(PixelValue) + 3 * sizeof(Balance) + sizeof(VertexCount)) +
+         2 * (pixels_count + word_bits - 1) / word_bits * sizeof(std::size_t);
+}
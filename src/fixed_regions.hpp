@@ -0,0 +1,51 @@
+#ifndef MAXFLOW_IMAGE_DENOISING_FIXED_REGIONS_HPP
+#define MAXFLOW_IMAGE_DENOISING_FIXED_REGIONS_HPP
+
+#include "grid_topology.hpp"
+#include "types.hpp"
+
+#include <cstddef>
+#include <vector>
+
+/// \brief Find the pixels whose labels are not fixed by the input alone.
+///
+/// \details
+/// A pixel is fixed if every optimal labelling assigns it
+/// its binarised input value.
+/// Uniform regions are fixed when their pixels prefer their values strongly
+/// enough to outweigh the discontinuity penalties on the region boundary,
+/// assuming the worst labels outside the region.
+///
+/// Each pixel p of a candidate region R has a balance
+/// |2 v_p - 255| - penalty * (number of neighbours
+/// that may disagree with p),
+/// and pixels of R may pass up to penalty units of their balances
+/// to each neighbour in R.
+/// If every pixel of R ends with a positive balance,
+/// flipping any subset of R increases the energy,
+/// so R keeps its labels in every optimal labelling.
+/// Pixels that cannot reach a positive balance are removed from R
+/// until the remaining pixels are certified.
+///
+/// \param topology The graph topology.
+/// Pixels outside it keep their binarised values
+/// and are never reported as unfixed.
+/// \param discontinuity_penalty The weight of edges between neighbouring pixels.
+/// \param pixels The input pixel values, indexed by y * width + x.
+///
+/// \return Whether each pixel, indexed by y * width + x,
+/// is in the topology and is not fixed.
+std::vector<bool> find_unfixed_pixels(
+  const GridTopology& topology,
+  EdgeCapacity discontinuity_penalty,
+  const std::vector<PixelValue>& pixels);
+
+/// \brief Estimate the bytes allocated to find the unfixed pixels
+/// of an image, including the copy of its pixel values.
+///
+/// \param height The image height.
+/// \param width The image width.
+std::size_t estimate_fixed_regions_memory_size(
+  ImageSize height, ImageSize width);
+
+#endif //MAXFLOW_IMAGE_DENOISING_FIXED_REGIONS_HPP
@@ -0,0 +1,615 @@
+#include "grid_topology.hpp"
+
+#include "max_flow_exceptions.hpp"
+#include "vertex_ordering.hpp"
+
+#include <boost/interprocess/exceptions.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <type_traits>
+
+using namespace std::string_literals;
+
+namespace
+{
+  /// \brief First bytes of every topology file.
+  constexpr std::array<char, 8> topology_magic{
+    'M', 'F', 'D', 'T', 'O', 'P', 'O', '\0'
+  };
+
+  /// \brief Version of the topology file layout.
+  /// \details Increment on any change of the header or the array layout.
+  constexpr std::uint32_t topology_version = 1;
+
+  /// \brief Marker to detect files written on a machine
+  /// with a different byte order.
+  constexpr std::uint32_t byte_order_mark = 0x01020304;
+
+  /// \brief Header of a topology file.
+  ///
+  /// \details
+  /// The header is followed by the pixel vertices, offsets, targets,
+  /// and reverse edges arrays, each aligned to topology_alignment bytes.
+  struct TopologyHeader
+  {
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    ImageSize rows;
+    ImageSize columns;
+    std::uint8_t vertex_count_size;
+    std::uint8_t edge_count_size;
+    std::uint16_t reserved;
+    VertexCount vertices_count;
+    std::uint32_t padding;
+    EdgeCount edges_count;
+  };
+
+  static_assert(std::is_trivially_copyable_v<TopologyHeader>);
+  static_assert(sizeof(TopologyHeader) == 40);
+
+  constexpr std::size_t topology_alignment = alignof(EdgeCount);
+
+  constexpr std::size_t align(const std::size_t position)
+  {
+    return (position + topology_alignment - 1) / topology_alignment *
+           topology_alignment;
+  }
+
+  /// \brief Positions of the arrays in a topology file.
+  struct TopologyLayout
+  {
+    std::size_t pixel_vertices;
+    std::size_t offsets;
+    std::size_t targets;
+    std::size_t reverse_edges;
+    std::size_t size;
+  };
+
+  TopologyLayout layout(const TopologyHeader& header)
+  {
+    TopologyLayout positions{};
+    positions.pixel_vertices = align(sizeof(TopologyHeader));
+    positions.offsets = align(
+      positions.pixel_vertices +
+      static_cast<std::size_t>(header.rows) * header.columns *
+      sizeof(VertexCount)
+    );
+    positions.targets = align(
+      positions.offsets +
+      (static_cast<std::size_t>(header.vertices_count) + 1) * sizeof(EdgeCount)
+    );
+    positions.reverse_edges = align(
+      positions.targets + header.edges_count * sizeof(VertexCount)
+    );
+    positions.size =
+      positions.reverse_edges + header.edges_count * sizeof(EdgeCount);
+    return positions;
+  }
+
+  template <typename T>
+  void write_array(
+    std::ofstream& stream,
+    const std::size_t position,
+    const std::span<const T> array)
+  {
+    const auto& written = static_cast<std::size_t>(stream.tellp());
+    const std::array<char, topology_alignment> zeros{};
+    stream.write(zeros.data(), static_cast<std::streamsize>(position - written));
+    stream.write(
+      reinterpret_cast<const char*>(array.data()),
+      static_cast<std::streamsize>(array.size_bytes())
+    );
+  }
+
+  template <typename T>
+  std::span<const T> read_array(
+    const boost::interprocess::mapped_region& region,
+    const std::size_t position,
+    const std::size_t size)
+  {
+    return {
+      reinterpret_cast<const T*>(
+        static_cast<const std::byte*>(region.get_address()) + position
+      ),
+      size
+    };
+  }
+
+  /// \brief Count the vertices and edges of the graph of the pixels
+  /// for which in_graph returns true.
+  template <typename PixelPredicate>
+  TopologySize measure_pixels(
+    const ImageSize height,
+    const ImageSize width,
+    const PixelPredicate& in_graph)
+  {
+    // Each pixel has edges to and from both terminals,
+    // and each pair of neighbouring pixels has edges in both directions.
+    VertexCount pixels_count = 0;
+    EdgeCount neighbours_count = 0;
+    for (VertexCount y = 0; y < height; ++y)
+    {
+      for (VertexCount x = 0; x < width; ++x)
+      {
+        const auto& pixel = y * width + x;
+        if (!in_graph(pixel))
+        {
+          continue;
+        }
+        ++pixels_count;
+        if (x + 1 < width and in_graph(pixel + 1))
+        {
+          ++neighbours_count;
+        }
+        if (y + 1 < height and in_graph(pixel + width))
+        {
+          ++neighbours_count;
+        }
+      }
+    }
+    return {pixels_count + 2, 4 * static_cast<EdgeCount>(pixels_count) +
+                              2 * neighbours_count};
+  }
+}
+
+GridTopology::GridTopology(
+  const ImageSize height,
+  const ImageSize width,
+  std::vector<VertexCount>&& pixel_vertices,
+  const bool with_edges)
+  : rows{height}
+  , columns{width}
+  , owned_pixel_vertices{std::move(pixel_vertices)}
+  , pixel_vertices{this->owned_pixel_vertices}
+{
+  this->measure_graph();
+  if (with_edges)
+  {
+    this->construct_edges();
+  }
+}
+
+GridTopology::GridTopology(
+  const ImageSize height,
+  const ImageSize width,
+  const std::span<const VertexCount> pixel_vertices)
+  : rows{height}
+  , columns{width}
+  , pixel_vertices{pixel_vertices}
+{
+  this->measure_graph();
+  this->construct_edges();
+}
+
+GridTopology::GridTopology(
+  const std::filesystem::path& path, const bool verify)
+{
+  try
+  {
+    const boost::interprocess::file_mapping file{
+      path.string().c_str(), boost::interprocess::read_only
+    };
+    this->mapping = std::make_unique<boost::interprocess::mapped_region>(
+      file, boost::interprocess::read_only
+    );
+  }
+  catch (const boost::interprocess::interprocess_exception& exception)
+  {
+    throw TopologyFileException{
+      "Cannot map topology file "s + path.string() + ": "s + exception.what()
+    };
+  }
+
+  TopologyHeader header{};
+  if (this->mapping->get_size() < sizeof(header))
+  {
+    throw TopologyFileException{
+      "Topology file "s + path.string() + " is too short"s
+    };
+  }
+  std::copy_n(
+    static_cast<const char*>(this->mapping->get_address()),
+    sizeof(header),
+    reinterpret_cast<char*>(&header)
+  );
+
+  if (header.magic != topology_magic)
+  {
+    throw TopologyFileException{
+      "File "s + path.string() + " is not a topology file"s
+    };
+  }
+  if (header.version != topology_version)
+  {
+    throw TopologyFileException{
+      "Topology file version "s + std::to_string(header.version) +
+      " is not supported, expected version "s +
+      std::to_string(topology_version)
+    };
+  }
+  if (header.byte_order != byte_order_mark or
+      header.vertex_count_size != sizeof(VertexCount) or
+      header.edge_count_size != sizeof(EdgeCount))
+  {
+    throw TopologyFileException{
+      "Topology file "s + path.string() +
+      " was written on an incompatible platform"s
+    };
+  }
+
+  // Bound the counts by the file size first,
+  // so that the layout computation cannot overflow.
+  const auto& file_size = this->mapping->get_size();
+  if (static_cast<std::size_t>(header.rows) * header.columns >
+        file_size / sizeof(VertexCount) or
+      header.vertices_count > file_size / sizeof(EdgeCount) or
+      header.edges_count > file_size / sizeof(EdgeCount))
+  {
+    throw TopologyFileException{
+      "Topology file "s + path.string() + " is corrupted: "s +
+      std::to_string(header.rows) + "x"s + std::to_string(header.columns) +
+      " pixels, "s + std::to_string(header.vertices_count) + " vertices and "s +
+      std::to_string(header.edges_count) + " edges do not fit into "s +
+      std::to_string(file_size) + " bytes"s
+    };
+  }
+  const auto& positions = layout(header);
+  if (header.vertices_count < 2 or this->mapping->get_size() != positions.size)
+  {
+    throw TopologyFileException{
+      "Topology file "s + path.string() + " is corrupted: expected "s +
+      std::to_string(positions.size) + " bytes, actual "s +
+      std::to_string(this->mapping->get_size())
+    };
+  }
+
+  this->rows = header.rows;
+  this->columns = header.columns;
+  this->graph_size = {header.vertices_count, header.edges_count};
+  this->pixel_vertices = read_array<VertexCount>(
+    *this->mapping,
+    positions.pixel_vertices,
+    static_cast<std::size_t>(header.rows) * header.columns
+  );
+  this->offsets = read_array<EdgeCount>(
+    *this->mapping,
+    positions.offsets,
+    static_cast<std::size_t>(header.vertices_count) + 1
+  );
+  this->targets = read_array<VertexCount>(
+    *this->mapping, positions.targets, header.edges_count
+  );
+  this->reverse_edges = read_array<EdgeCount>(
+    *this->mapping, positions.reverse_edges, header.edges_count
+  );
+
+  if (this->offsets.back() != header.edges_count)
+  {
+    throw TopologyFileException{
+      "Topology file "s + path.string() + " is corrupted: expected "s +
+      std::to_string(header.edges_count) + " edges, actual "s +
+      std::to_string(this->offsets.back())
+    };
+  }
+
+  // The full check reads every page of the file,
+  // so it is only done on request.
+  if (verify)
+  {
+    this->verify(path);
+  }
+}
+
+GridTopology::~GridTopology() = default;
+
+void GridTopology::verify(const std::filesystem::path& path) const
+{
+  const auto& corrupted = [&path](const std::string& reason)
+  {
+    return TopologyFileException{
+      "Topology file "s + path.string() + " is corrupted: "s + reason
+    };
+  };
+
+  const VertexCount vertices_count = num_vertices(*this);
+  const EdgeCount edges_count = this->targets.size();
+  const VertexCount pixels_count = vertices_count - 2;
+  if (pixels_count > this->pixel_vertices.size())
+  {
+    throw corrupted(
+      std::to_string(pixels_count) + " pixel vertices in an image of "s +
+      std::to_string(this->pixel_vertices.size()) + " pixels"s
+    );
+  }
+
+  // Each pixel vertex must belong to exactly one pixel.
+  std::vector<bool> numbered(pixels_count);
+  for (const auto& vertex : this->pixel_vertices)
+  {
+    if (vertex == no_vertex)
+    {
+      continue;
+    }
+    if (vertex >= pixels_count or numbered[vertex])
+    {
+      throw corrupted(
+        "pixel vertex "s + std::to_string(vertex) +
+        " is out of range or repeated"s
+      );
+    }
+    numbered[vertex] = true;
+  }
+  if (std::ranges::find(numbered, false) != numbered.end())
+  {
+    throw corrupted("some pixel vertices have no pixels"s);
+  }
+
+  if (this->offsets.front() != 0)
+  {
+    throw corrupted(
+      "edge offsets start at "s + std::to_string(this->offsets.front())
+    );
+  }
+  for (VertexCount vertex = 0; vertex < vertices_count; ++vertex)
+  {
+    if (this->offsets[vertex] > this->offsets[vertex + 1])
+    {
+      throw corrupted(
+        "edge offsets of vertex "s + std::to_string(vertex) + " decrease"s
+      );
+    }
+  }
+
+  // Each edge must end at an existing vertex
+  // and have a reverse edge going back to its source.
+  for (auto [ei, ei_end] = edges(*this); ei != ei_end; ++ei)
+  {
+    const TopologyEdge& current_edge = *ei;
+    const auto& edge_target = this->targets[current_edge.index];
+    const auto& reverse_edge = this->reverse_edges[current_edge.index];
+    if (edge_target >= vertices_count or edge_target == current_edge.source)
+    {
+      throw corrupted(
+        "edge "s + std::to_string(current_edge.index) +
+        " has an invalid target "s + std::to_string(edge_target)
+      );
+    }
+    if (reverse_edge >= edges_count or
+        this->reverse_edges[reverse_edge] != current_edge.index or
+        this->targets[reverse_edge] != current_edge.source or
+        reverse_edge < this->offsets[edge_target] or
+        reverse_edge >= this->offsets[edge_target + 1])
+    {
+      throw corrupted(
+        "edge "s + std::to_string(current_edge.index) +
+        " has an invalid reverse edge "s + std::to_string(reverse_edge)
+      );
+    }
+  }
+}
+
+void GridTopology::save(const std::filesystem::path& path) const
+{
+  if (!this->has_edges())
+  {
+    // Save the graph described by the numbering.
+    GridTopology{this->rows, this->columns, this->pixel_vertices}.save(path);
+    return;
+  }
+
+  TopologyHeader header{};
+  header.magic = topology_magic;
+  header.version = topology_version;
+  header.byte_order = byte_order_mark;
+  header.rows = this->rows;
+  header.columns = this->columns;
+  header.vertex_count_size = sizeof(VertexCount);
+  header.edge_count_size = sizeof(EdgeCount);
+  header.vertices_count = num_vertices(*this);
+  header.edges_count = num_edges(*this);
+  const auto& positions = layout(header);
+
+  std::ofstream stream{path, std::ios::binary | std::ios::trunc};
+  stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  write_array(stream, positions.pixel_vertices, this->pixel_vertices);
+  write_array(stream, positions.offsets, this->offsets);
+  write_array(stream, positions.targets, this->targets);
+  write_array(stream, positions.reverse_edges, this->reverse_edges);
+  stream.close();
+  if (!stream)
+  {
+    throw TopologyFileException{
+      "Cannot write topology file "s + path.string()
+    };
+  }
+}
+
+TopologySize GridTopology::measure(
+  const ImageSize height,
+  const ImageSize width,
+  const std::vector<bool>& mask)
+{
+  if (mask.empty())
+  {
+    const VertexCount pixels_count = static_cast<VertexCount>(height) * width;
+    const EdgeCount neighbours_count =
+      (height == 0 or width == 0)
+      ? 0
+      : static_cast<EdgeCount>(height) * (width - 1) +
+        static_cast<EdgeCount>(height - 1) * width;
+    return {pixels_count + 2, 4 * static_cast<EdgeCount>(pixels_count) +
+                              2 * neighbours_count};
+  }
+
+  return measure_pixels(
+    height,
+    width,
+    [&mask](const VertexCount pixel)
+    {
+      return mask[pixel];
+    }
+  );
+}
+
+std::size_t GridTopology::estimate_memory_size(
+  const ImageSize height,
+  const ImageSize width,
+  const TopologySize& size,
+  const bool with_edges)
+{
+  return static_cast<std::size_t>(height) * width * sizeof(VertexCount) +
+         (with_edges ? estimate_edges_memory_size(size) : 0);
+}
+
+std::size_t GridTopology::estimate_edges_memory_size(const TopologySize& size)
+{
+  // Mirrors the allocations of GridTopology::construct_edges,
+  // including the reserved capacity of the targets.
+  const std::size_t pixels_count = size.vertices - 2;
+  return (pixels_count + 3) * sizeof(EdgeCount) +
+         std::max<std::size_t>(8 * pixels_count, size.edges) *
+         sizeof(VertexCount) +
+         size.edges * sizeof(EdgeCount);
+}
+
+std::size_t GridTopology::memory_size() const
+{
+  return this->owned_pixel_vertices.capacity() * sizeof(VertexCount) +
+         this->owned_offsets.capacity() * sizeof(EdgeCount) +
+         this->owned_targets.capacity() * sizeof(VertexCount) +
+         this->owned_reverse_edges.capacity() * sizeof(EdgeCount);
+}
+
+void GridTopology::measure_graph()
+{
+  if (this->pixel_vertices.size() !=
+      static_cast<VertexCount>(this->rows) * this->columns)
+  {
+    throw EdgeInitialisationException{
+      "Expected "s +
+      std::to_string(static_cast<VertexCount>(this->rows) * this->columns) +
+      " pixel vertices but got "s +
+      std::to_string(this->pixel_vertices.size())
+    };
+  }
+
+  this->graph_size = measure_pixels(
+    this->rows,
+    this->columns,
+    [this](const VertexCount pixel)
+    {
+      return this->pixel_vertices[pixel] != no_vertex;
+    }
+  );
+}
+
+void GridTopology::construct_edges()
+{
+  const VertexCount pixels_count = this->graph_size.vertices - 2;
+  const VertexCount source_index = pixels_count;
+  const VertexCount sink_index = pixels_count + 1;
+
+  // Edges are grouped by their source vertices,
+  // so walk the pixels in the vertex order.
+  std::vector<VertexCount> vertex_pixels(pixels_count);
+  for (VertexCount pixel = 0; pixel < this->pixel_vertices.size(); ++pixel)
+  {
+    if (this->pixel_vertices[pixel] != no_vertex)
+    {
+      vertex_pixels[this->pixel_vertices[pixel]] = pixel;
+    }
+  }
+
+  // Each pixel has at most 4 neighbours and 2 terminals,
+  // and each terminal has an edge to each pixel.
+  this->owned_offsets.reserve(static_cast<std::size_t>(pixels_count) + 3);
+  this->owned_targets.reserve(8 * static_cast<std::size_t>(pixels_count));
+
+  for (VertexCount current_vertex = 0; current_vertex < pixels_count;
+       ++current_vertex)
+  {
+    this->owned_offsets.push_back(this->owned_targets.size());
+
+    const auto& pixel = vertex_pixels[current_vertex];
+    const auto& y = pixel / this->columns;
+    const auto& x = pixel % this->columns;
+    const auto& add_neighbour = [this](const VertexCount neighbour)
+    {
+      const auto& neighbour_vertex = this->pixel_vertices[neighbour];
+      if (neighbour_vertex != no_vertex)
+      {
+        this->owned_targets.push_back(neighbour_vertex);
+      }
+    };
+    if (x + 1 < this->columns)
+    {
+      add_neighbour(pixel + 1);
+    }
+    if (x > 0)
+    {
+      add_neighbour(pixel - 1);
+    }
+    if (y + 1 < this->rows)
+    {
+      add_neighbour(pixel + this->columns);
+    }
+    if (y > 0)
+    {
+      add_neighbour(pixel - this->columns);
+    }
+
+    this->owned_targets.push_back(source_index);
+    this->owned_targets.push_back(sink_index);
+  }
+
+  this->owned_offsets.push_back(this->owned_targets.size());
+  for (VertexCount vertex = 0; vertex < pixels_count; ++vertex)
+  {
+    this->owned_targets.push_back(vertex);
+  }
+  this->owned_offsets.push_back(this->owned_targets.size());
+  for (VertexCount vertex = 0; vertex < pixels_count; ++vertex)
+  {
+    this->owned_targets.push_back(vertex);
+  }
+  this->owned_offsets.push_back(this->owned_targets.size());
+
+  this->offsets = this->owned_offsets;
+  this->targets = this->owned_targets;
+
+  this->add_reverse_edges();
+  this->reverse_edges = this->owned_reverse_edges;
+}
+
+void GridTopology::add_reverse_edges()
+{
+  this->owned_reverse_edges.resize(this->owned_targets.size());
+  for (auto [ei, ei_end] = edges(*this); ei != ei_end; ++ei)
+  {
+    const TopologyEdge& current_edge = *ei;
+    const auto& edge_source = current_edge.source;
+    const auto& edge_target = this->targets[current_edge.index];
+    if (edge_source > edge_target)
+    {
+      const auto& [reverse_edge, reverse_edge_exists] = this->edge(
+        edge_target, edge_source
+      );
+      if (!reverse_edge_exists)
+      {
+        throw EdgeInitialisationException{
+          "Edge from vertex "s + std::to_string(edge_target) + " to vertex "s +
+          std::to_string(edge_source) + " does not exist in reverse edges list"s
+        };
+      }
+      this->owned_reverse_edges[current_edge.index] = reverse_edge.index;
+      this->owned_reverse_edges[reverse_edge.index] = current_edge.index;
+    }
+  }
+}
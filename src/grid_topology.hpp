@@ -0,0 +1,429 @@
+#ifndef MAXFLOW_IMAGE_DENOISING_GRID_TOPOLOGY_HPP
+#define MAXFLOW_IMAGE_DENOISING_GRID_TOPOLOGY_HPP
+
+#include "types.hpp"
+
+#include <boost/graph/graph_traits.hpp>
+#include <boost/iterator/counting_iterator.hpp>
+#include <boost/iterator/iterator_facade.hpp>
+
+#include <cstddef>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace boost::interprocess
+{
+  /// \brief Forward declaration of Boost.Interprocess memory mapping.
+  class mapped_region;
+}
+
+/// \brief Edge of a GridTopology.
+struct TopologyEdge
+{
+  /// \brief Source vertex of the edge.
+  VertexCount source = 0;
+  /// \brief Index of the edge in the edge arrays.
+  EdgeCount index = 0;
+
+  friend bool operator==(const TopologyEdge&, const TopologyEdge&) = default;
+};
+
+/// \brief Number of vertices and edges of a GridTopology.
+struct TopologySize
+{
+  VertexCount vertices = 0;
+  EdgeCount edges = 0;
+};
+
+/// \class GridTopology
+/// \brief Immutable graph of an image grid with a source and a sink.
+///
+/// \details
+/// The topology is stored in compressed sparse row format:
+/// the out-edges of vertex v have indices
+/// [offsets[v], offsets[v + 1]) and end at targets[index].
+/// Each edge also knows the index of its reverse edge.
+///
+/// The arrays are either built in memory
+/// or memory-mapped read-only from a topology file,
+/// so that processes using the same file share a single physical copy.
+///
+/// A topology may also hold the pixel numbering alone, without edges,
+/// for users that only need the vertex index of each pixel.
+/// Its edges can then be built separately over the same numbering.
+///
+/// The class models the Boost Graph Library
+/// VertexListGraph, EdgeListGraph, and IncidenceGraph concepts.
+class GridTopology
+{
+public:
+  using vertex_descriptor = VertexCount;
+  using edge_descriptor = TopologyEdge;
+  using directed_category = boost::directed_tag;
+  using edge_parallel_category = boost::disallow_parallel_edge_tag;
+
+  struct traversal_category
+    : boost::incidence_graph_tag
+    , boost::vertex_list_graph_tag
+    , boost::edge_list_graph_tag
+  {
+  };
+
+  using vertices_size_type = VertexCount;
+  using edges_size_type = EdgeCount;
+  using degree_size_type = EdgeCount;
+
+  using vertex_iterator = boost::counting_iterator<VertexCount>;
+
+  /// \brief Iterator over the out-edges of a vertex.
+  class out_edge_iterator : public boost::iterator_facade<
+    out_edge_iterator,
+    TopologyEdge,
+    boost::forward_traversal_tag,
+    TopologyEdge
+  >
+  {
+  public:
+    out_edge_iterator() = default;
+
+    out_edge_iterator(const VertexCount source, const EdgeCount index)
+      : current{source, index}
+    {
+    }
+
+  private:
+    friend class boost::iterator_core_access;
+
+    [[nodiscard]] TopologyEdge dereference() const
+    {
+      return this->current;
+    }
+
+    [[nodiscard]] bool equal(const out_edge_iterator& other) const
+    {
+      return this->current.index == other.current.index;
+    }
+
+    void increment()
+    {
+      ++this->current.index;
+    }
+
+    TopologyEdge current;
+  };
+
+  /// \brief Iterator over all edges in the order of their indices.
+  class edge_iterator : public boost::iterator_facade<
+    edge_iterator,
+    TopologyEdge,
+    boost::forward_traversal_tag,
+    TopologyEdge
+  >
+  {
+  public:
+    edge_iterator() = default;
+
+    edge_iterator(
+      const std::span<const EdgeCount> offsets, const TopologyEdge edge)
+      : offsets{offsets}
+      , current{edge}
+    {
+      this->skip_exhausted_sources();
+    }
+
+  private:
+    friend class boost::iterator_core_access;
+
+    [[nodiscard]] TopologyEdge dereference() const
+    {
+      return this->current;
+    }
+
+    [[nodiscard]] bool equal(const edge_iterator& other) const
+    {
+      return this->current.index == other.current.index;
+    }
+
+    void increment()
+    {
+      ++this->current.index;
+      this->skip_exhausted_sources();
+    }
+
+    /// \brief Advance the source past vertices without remaining out-edges.
+    void skip_exhausted_sources()
+    {
+      while (this->current.index < this->offsets.back() and
+             this->current.index >= this->offsets[this->current.source + 1])
+      {
+        ++this->current.source;
+      }
+    }
+
+    std::span<const EdgeCount> offsets;
+    TopologyEdge current;
+  };
+
+  /// \brief Build the topology of an image grid.
+  ///
+  /// \param height The image height.
+  /// \param width The image width.
+  /// \param pixel_vertices The vertex index of each pixel,
+  /// indexed by y * width + x, or no_vertex for pixels outside the graph.
+  /// Vertex indices must have no gaps.
+  /// \param with_edges Whether to build the edges
+  /// or only keep the pixel numbering.
+  GridTopology(
+    ImageSize height,
+    ImageSize width,
+    std::vector<VertexCount>&& pixel_vertices,
+    bool with_edges = true);
+
+  /// \brief Build the edges over the pixel numbering of another topology
+  /// without copying it.
+  ///
+  /// \param height The image height.
+  /// \param width The image width.
+  /// \param pixel_vertices The numbering returned by GridTopology::numbering.
+  /// It must outlive the constructed topology.
+  GridTopology(
+    ImageSize height,
+    ImageSize width,
+    std::span<const VertexCount> pixel_vertices);
+
+  /// \brief Memory-map a topology file written by GridTopology::save.
+  ///
+  /// \details
+  /// Only the header and the file size are checked by default,
+  /// so loading does not touch the arrays.
+  ///
+  /// \param path The path to the topology file.
+  /// \param verify Whether to also check the consistency of all arrays.
+  /// This reads the whole file once, which takes time linear in its size.
+  ///
+  /// \throws TopologyFileException If the file is not a valid topology file.
+  explicit GridTopology(const std::filesystem::path& path, bool verify = false);
+
+  GridTopology(const GridTopology&) = delete;
+
+  GridTopology& operator=(const GridTopology&) = delete;
+
+  ~GridTopology();
+
+  /// \brief Write the topology to a versioned binary file.
+  ///
+  /// \param path The path to the topology file.
+  void save(const std::filesystem::path& path) const;
+
+  /// \brief Count the vertices and edges of the topology
+  /// of the masked pixels without building it.
+  ///
+  /// \param height The image height.
+  /// \param width The image width.
+  /// \param mask Whether each pixel, indexed by y * width + x,
+  /// is in the graph. An empty mask selects all pixels.
+  [[nodiscard]] static TopologySize measure(
+    ImageSize height, ImageSize width, const std::vector<bool>& mask);
+
+  /// \brief Estimate the bytes allocated to build a topology.
+  ///
+  /// \param height The image height.
+  /// \param width The image width.
+  /// \param size The size of the topology returned by GridTopology::measure.
+  /// \param with_edges Whether the edges are built
+  /// or only the pixel numbering.
+  [[nodiscard]] static std::size_t estimate_memory_size(
+    ImageSize height,
+    ImageSize width,
+    const TopologySize& size,
+    bool with_edges = true);
+
+  /// \brief Estimate the bytes allocated to build the edges of a topology
+  /// over an existing pixel numbering.
+  ///
+  /// \param size The size of the topology returned by GridTopology::measure.
+  [[nodiscard]] static std::size_t estimate_edges_memory_size(
+    const TopologySize& size);
+
+  /// \brief Get the bytes allocated by the topology.
+  /// \details Memory-mapped arrays are not counted,
+  /// since their pages are shared by all processes mapping the file.
+  [[nodiscard]] std::size_t memory_size() const;
+
+  /// \brief Get the number of vertices and edges of the graph,
+  /// including the edges that are not built.
+  [[nodiscard]] TopologySize size() const
+  {
+    return this->graph_size;
+  }
+
+  /// \brief Check whether the edges are built.
+  /// \details Only the pixel numbering and the vertices
+  /// of a topology without edges may be used.
+  [[nodiscard]] bool has_edges() const
+  {
+    return !this->offsets.empty();
+  }
+
+  /// \brief Get the vertex index of each pixel, indexed by y * width + x.
+  [[nodiscard]] std::span<const VertexCount> numbering() const
+  {
+    return this->pixel_vertices;
+  }
+
+  // The accessors below are called in the innermost loops of the solver,
+  // so they are defined inline.
+
+  [[nodiscard]] ImageSize height() const
+  {
+    return this->rows;
+  }
+
+  [[nodiscard]] ImageSize width() const
+  {
+    return this->columns;
+  }
+
+  /// \brief Get the vertex index of the pixel (y, x).
+  /// \return The vertex index or no_vertex if the pixel is not in the graph.
+  [[nodiscard]] VertexCount pixel_vertex(
+    const ImageSize y, const ImageSize x) const
+  {
+    return this->pixel_vertices[static_cast<VertexCount>(y) * this->columns + x];
+  }
+
+  [[nodiscard]] VertexCount source() const
+  {
+    return num_vertices(*this) - 2;
+  }
+
+  [[nodiscard]] VertexCount sink() const
+  {
+    return num_vertices(*this) - 1;
+  }
+
+  /// \brief Find the edge between two vertices.
+  /// \return The edge and whether it exists.
+  [[nodiscard]] std::pair<TopologyEdge, bool> edge(
+    const VertexCount source, const VertexCount target) const
+  {
+    for (auto index = this->offsets[source]; index < this->offsets[source + 1];
+         ++index)
+    {
+      if (this->targets[index] == target)
+      {
+        return {{source, index}, true};
+      }
+    }
+    return {{}, false};
+  }
+
+  /// \brief Get the reverse of the edge.
+  [[nodiscard]] TopologyEdge reverse(const TopologyEdge& edge) const
+  {
+    return {this->targets[edge.index], this->reverse_edges[edge.index]};
+  }
+
+  [[nodiscard]] static VertexCount null_vertex()
+  {
+    return std::numeric_limits<VertexCount>::max();
+  }
+
+  friend std::pair<vertex_iterator, vertex_iterator> vertices(
+    const GridTopology& topology)
+  {
+    return {vertex_iterator{0}, vertex_iterator{num_vertices(topology)}};
+  }
+
+  friend VertexCount num_vertices(const GridTopology& topology)
+  {
+    return topology.graph_size.vertices;
+  }
+
+  friend std::pair<edge_iterator, edge_iterator> edges(
+    const GridTopology& topology)
+  {
+    return {
+      edge_iterator{topology.offsets, {0, 0}},
+      edge_iterator{
+        topology.offsets, {num_vertices(topology), num_edges(topology)}
+      }
+    };
+  }
+
+  friend EdgeCount num_edges(const GridTopology& topology)
+  {
+    return topology.has_edges() ? topology.offsets.back() : 0;
+  }
+
+  friend std::pair<out_edge_iterator, out_edge_iterator> out_edges(
+    const VertexCount vertex, const GridTopology& topology)
+  {
+    return {
+      out_edge_iterator{vertex, topology.offsets[vertex]},
+      out_edge_iterator{vertex, topology.offsets[vertex + 1]}
+    };
+  }
+
+  friend EdgeCount out_degree(
+    const VertexCount vertex, const GridTopology& topology)
+  {
+    return topology.offsets[vertex + 1] - topology.offsets[vertex];
+  }
+
+  friend VertexCount source(const TopologyEdge& edge, const GridTopology&)
+  {
+    return edge.source;
+  }
+
+  friend VertexCount target(
+    const TopologyEdge& edge, const GridTopology& topology)
+  {
+    return topology.targets[edge.index];
+  }
+
+private:
+  /// \brief Check the size of the pixel numbering
+  /// and count the vertices and edges of its graph.
+  void measure_graph();
+
+  void construct_edges();
+
+  /// \brief Check the consistency of memory-mapped arrays,
+  /// so that a corrupted file cannot crash the solver.
+  ///
+  /// \throws TopologyFileException If the arrays are inconsistent.
+  void verify(const std::filesystem::path& path) const;
+
+  void add_reverse_edges();
+
+  ImageSize rows = 0;
+  ImageSize columns = 0;
+  TopologySize graph_size;
+
+  /// \brief Storage of a topology built in memory.
+  std::vector<VertexCount> owned_pixel_vertices;
+  std::vector<EdgeCount> owned_offsets;
+  std::vector<VertexCount> owned_targets;
+  std::vector<EdgeCount> owned_reverse_edges;
+
+  /// \brief Storage of a memory-mapped topology.
+  std::unique_ptr<boost::interprocess::mapped_region> mapping;
+
+  /// \brief Vertex index of each pixel, indexed by y * columns + x,
+  /// or no_vertex for pixels outside the graph.
+  std::span<const VertexCount> pixel_vertices;
+  /// \brief Index of the first out-edge of each vertex
+  /// followed by the number of edges.
+  std::span<const EdgeCount> offsets;
+  /// \brief Target vertex of each edge.
+  std::span<const VertexCount> targets;
+  /// \brief Index of the reverse of each edge.
+  std::span<const EdgeCount> reverse_edges;
+};
+
+#endif //MAXFLOW_IMAGE_DENOISING_GRID_TOPOLOGY_HPP
@@ -1,18 +1,107 @@
 #include "binary_image_denoiser.hpp"
 #include "greyscale_image.hpp"
+#include "multi_channel_image.hpp"
 #include "types.hpp"
 
+#include <cstddef>
 #include <exception>
 #include <filesystem>
 #include <iostream>
+#include <limits>
+#include <optional>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+  constexpr std::string_view vertex_ordering_option = "--vertex-ordering=";
+  constexpr std::string_view multi_channel_option = "--multi-channel";
+  constexpr std::string_view mask_option = "--mask=";
+  constexpr std::string_view region_option = "--region=";
+  constexpr std::string_view topology_option = "--topology=";
+  constexpr std::string_view save_topology_option = "--save-topology=";
+  constexpr std::string_view verify_topology_option = "--verify-topology";
+  constexpr std::string_view memory_budget_option = "--memory-budget=";
+  constexpr std::string_view report_memory_option = "--report-memory";
+  constexpr std::string_view collapse_option = "--collapse-fixed-regions";
+
+  constexpr std::size_t bytes_per_mebibyte = std::size_t{1} << 20;
+
+  /// \brief Parse a region given as "y,x,height,width".
+  std::optional<ImageRegion> parse_region(const std::string_view text)
+  {
+    std::istringstream stream{std::string{text}};
+    ImageRegion region{};
+    char y_separator = 0;
+    char x_separator = 0;
+    char height_separator = 0;
+    stream >> region.y >> y_separator >> region.x >> x_separator
+           >> region.height >> height_separator >> region.width;
+    if (!stream or !stream.eof() or y_separator != ',' or
+        x_separator != ',' or height_separator != ',')
+    {
+      return std::nullopt;
+    }
+    return region;
+  }
+
+  template <typename Image>
+  void print_memory_estimate(
+    const Image& image,
+    const PixelValue channels_count,
+    const DenoiserOptions& options)
+  {
+    const auto& estimate = BinaryImageDenoiser::estimate_memory(
+      image.height(), image.width(), options);
+    std::cout << "Estimated memory: " << estimate.total(channels_count)
+              << " bytes (topology " << estimate.topology
+              << ", solver " << estimate.solver
+              << " and labels " << estimate.labels << " per channel)"
+              << std::endl;
+  }
+
+  template <typename Image>
+  BinaryImageDenoiser construct_denoiser(
+    const Image& image,
+    const DiscontinuityPenalty discontinuity_penalty,
+    const DenoiserOptions& options,
+    const std::optional<std::filesystem::path>& topology_path,
+    const std::optional<std::filesystem::path>& mask_path,
+    const std::vector<ImageRegion>& regions)
+  {
+    if (topology_path)
+    {
+      return {*topology_path, discontinuity_penalty, options};
+    }
+    if (mask_path)
+    {
+      return {GreyscaleImage{*mask_path}, discontinuity_penalty, options};
+    }
+    if (!regions.empty())
+    {
+      return {
+        image.height(), image.width(), regions, discontinuity_penalty, options
+      };
+    }
+    return {image.height(), image.width(), discontinuity_penalty, options};
+  }
+}
 
 int main(const int argc, const char* argv[]) try
 {
-  if (argc != 4)
+  if (argc < 4)
   {
     std::cout << "Usage: " << argv[0]
               << " <input image> <output image> <discontinuity penalty>"
+              << " [--vertex-ordering=row-major|tiled|z-order]"
+              << " [--multi-channel]"
+              << " [--mask=<mask image> | --region=<y>,<x>,<height>,<width>...]"
+              << " [--topology=<topology file> [--verify-topology]"
+              << " | --save-topology=<topology file>]"
+              << " [--memory-budget=<MiB>] [--report-memory]"
+              << " [--collapse-fixed-regions]"
               << std::endl;
     return EXIT_FAILURE;
   }
@@ -60,12 +149,178 @@ int main(const int argc, const char* argv[]) try
     return EXIT_FAILURE;
   }
 
+  DenoiserOptions options;
+  bool multi_channel = false;
+  std::optional<std::filesystem::path> mask_path;
+  std::vector<ImageRegion> regions;
+  std::optional<std::filesystem::path> topology_path;
+  std::optional<std::filesystem::path> save_topology_path;
+  bool report_memory = false;
+  for (int argument_index = 4; argument_index < argc; ++argument_index)
+  {
+    const std::string_view argument{argv[argument_index]};
+    if (argument.starts_with(vertex_ordering_option))
+    {
+      const auto& ordering = argument.substr(vertex_ordering_option.size());
+      if (ordering == "row-major")
+      {
+        options.vertex_ordering = VertexOrdering::row_major;
+      }
+      else if (ordering == "tiled")
+      {
+        options.vertex_ordering = VertexOrdering::tiled;
+      }
+      else if (ordering == "z-order")
+      {
+        options.vertex_ordering = VertexOrdering::z_order;
+      }
+      else
+      {
+        std::cerr << "Vertex ordering should be one of "
+                  << "'row-major', 'tiled', or 'z-order' but got: '"
+                  << ordering << '\'' << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+    else if (argument == multi_channel_option)
+    {
+      multi_channel = true;
+    }
+    else if (argument.starts_with(mask_option))
+    {
+      mask_path = std::filesystem::absolute(
+        argument.substr(mask_option.size()));
+      if (!std::filesystem::exists(*mask_path))
+      {
+        std::cerr << "Mask file does not exist: " << *mask_path << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+    else if (argument.starts_with(region_option))
+    {
+      const auto& region = parse_region(argument.substr(region_option.size()));
+      if (!region)
+      {
+        std::cerr << "Region should be given as '<y>,<x>,<height>,<width>'"
+                  << " but got: '" << argument << '\'' << std::endl;
+        return EXIT_FAILURE;
+      }
+      regions.push_back(*region);
+    }
+    else if (argument.starts_with(topology_option))
+    {
+      topology_path = std::filesystem::absolute(
+        argument.substr(topology_option.size()));
+      if (!std::filesystem::exists(*topology_path))
+      {
+        std::cerr << "Topology file does not exist: " << *topology_path
+                  << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+    else if (argument.starts_with(save_topology_option))
+    {
+      save_topology_path = std::filesystem::absolute(
+        argument.substr(save_topology_option.size()));
+    }
+    else if (argument.starts_with(memory_budget_option))
+    {
+      const std::string budget{argument.substr(memory_budget_option.size())};
+      std::size_t budget_mebibytes = std::numeric_limits<std::size_t>::max();
+      if (!budget.empty() and
+          budget.find_first_not_of("0123456789") == std::string::npos and
+          budget.size() < std::numeric_limits<std::size_t>::digits10)
+      {
+        budget_mebibytes = std::stoull(budget);
+      }
+      if (budget_mebibytes >
+          std::numeric_limits<std::size_t>::max() / bytes_per_mebibyte)
+      {
+        std::cerr << "Memory budget should be a number of mebibytes"
+                  << " but got: '" << budget << '\'' << std::endl;
+        return EXIT_FAILURE;
+      }
+      options.memory_budget = budget_mebibytes * bytes_per_mebibyte;
+    }
+    else if (argument == report_memory_option)
+    {
+      report_memory = true;
+    }
+    else if (argument == collapse_option)
+    {
+      options.collapse_fixed_regions = true;
+    }
+    else if (argument == verify_topology_option)
+    {
+      options.verify_topology = true;
+    }
+    else
+    {
+      std::cerr << "Unknown option: '" << argument << '\'' << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (mask_path and !regions.empty())
+  {
+    std::cerr << "Mask and regions cannot be used together" << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (topology_path and (mask_path or !regions.empty() or save_topology_path))
+  {
+    std::cerr << "Topology file already defines the graph"
+              << " and cannot be used with a mask, regions, or saving"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (options.verify_topology and !topology_path)
+  {
+    std::cerr << "Only a topology file can be verified" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (multi_channel)
+  {
+    MultiChannelImage image{input_path.string()};
+    if (report_memory)
+    {
+      print_memory_estimate(image, image.channels(), options);
+    }
+    const auto& max_flow_solver = construct_denoiser(
+      image, discontinuity_penalty, options, topology_path, mask_path,
+      regions);
+    if (save_topology_path)
+    {
+      max_flow_solver.save_topology(*save_topology_path);
+    }
+    max_flow_solver(image);
+    image.save(output_path);
+    if (report_memory)
+    {
+      std::cout << "Peak memory: " << max_flow_solver.peak_memory()
+                << " bytes" << std::endl;
+    }
+    return EXIT_SUCCESS;
+  }
+
   GreyscaleImage image{input_path.string()};
-  BinaryImageDenoiser max_flow_solver{
-    image.height(), image.width(), discontinuity_penalty
-  };
+  if (report_memory)
+  {
+    print_memory_estimate(image, 1, options);
+  }
+  const auto& max_flow_solver = construct_denoiser(
+    image, discontinuity_penalty, options, topology_path, mask_path, regions);
+  if (save_topology_path)
+  {
+    max_flow_solver.save_topology(*save_topology_path);
+  }
   max_flow_solver(image);
   image.save(output_path);
+  if (report_memory)
+  {
+    std::cout << "Peak memory: " << max_flow_solver.peak_memory() << " bytes"
+              << std::endl;
+  }
 
   return EXIT_SUCCESS;
 } catch (const std::exception& exception)
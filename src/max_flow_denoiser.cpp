@@ -1,255 +1,562 @@
 #include "max_flow_denoiser.hpp"
 
+#include "fixed_regions.hpp"
 #include "max_flow_exceptions.hpp"
+#include "vertex_ordering.hpp"
 
-#include <boost/graph/named_function_params.hpp>
+#include <boost/property_map/function_property_map.hpp>
+#include <boost/property_map/property_map.hpp>
 
+#include <algorithm>
+#include <climits>
+#include <future>
 #include <limits>
 #include <string>
+#include <utility>
 
 using namespace std::string_literals;
 
+namespace
+{
+  /// \brief Get the bytes of a std::vector<bool> of the given size,
+  /// which packs the bits into words.
+  std::size_t bit_vector_memory_size(const std::size_t bits_count)
+  {
+    constexpr std::size_t word_bits = sizeof(std::size_t) * CHAR_BIT;
+    return (bits_count + word_bits - 1) / word_bits * sizeof(std::size_t);
+  }
+
+  /// \brief Get the bytes of the working arrays
+  /// that the Boykov-Kolmogorov algorithm allocates during solving:
+  /// the active vertex flags, the parent flags, and the timestamps.
+  /// \details The queues of active and orphan vertices are not counted,
+  /// since their sizes depend on the image and are usually small.
+  std::size_t max_flow_memory_size(const VertexCount vertices_count)
+  {
+    return 2 * bit_vector_memory_size(vertices_count) +
+           static_cast<std::size_t>(vertices_count) * sizeof(long);
+  }
+}
+
 BinaryImageDenoiser::MaxFlowDenoiser::MaxFlowDenoiser(
   const ImageSize height,
   const ImageSize width,
-  const EdgeCapacity discontinuity_penalty)
-  : MaxFlowDenoiser{
-    height,
-    width,
-    discontinuity_penalty,
-    static_cast<VertexCount>(height) * width + 2,
-  }
+  const EdgeCapacity discontinuity_penalty,
+  const DenoiserOptions& options,
+  const std::vector<bool>& mask)
+  : discontinuity_penalty{discontinuity_penalty}
+  , options{options}
+  , topology{this->construct_topology(height, width, mask)}
 {
+  this->update_peak_memory();
+}
+
+BinaryImageDenoiser::MaxFlowDenoiser::MaxFlowDenoiser(
+  const std::filesystem::path& topology_path,
+  const EdgeCapacity discontinuity_penalty,
+  const DenoiserOptions& options)
+  : discontinuity_penalty{discontinuity_penalty}
+  , options{options}
+  , topology{topology_path, options.verify_topology}
+{
+  fit_channels(this->options.memory_budget, this->estimate_memory(), 1);
+  this->update_peak_memory();
+}
+
+void BinaryImageDenoiser::MaxFlowDenoiser::save_topology(
+  const std::filesystem::path& path) const
+{
+  this->topology.save(path);
+}
+
+MemoryEstimate BinaryImageDenoiser::MaxFlowDenoiser::estimate_memory(
+  const ImageSize height,
+  const ImageSize width,
+  const std::vector<bool>& mask)
+{
+  // When collapsing, the edges of the whole graph are only built
+  // if a channel cannot be collapsed, but they are charged anyway.
+  const auto& size = GridTopology::measure(height, width, mask);
+  return {
+    .topology = GridTopology::estimate_memory_size(height, width, size),
+    .solver = estimate_solver_memory_size(size),
+    .labels = estimate_labels_memory_size(size),
+  };
+}
+
+std::size_t BinaryImageDenoiser::MaxFlowDenoiser::peak_memory() const
+{
+  return this->peak_memory_size;
 }
 
 void BinaryImageDenoiser::MaxFlowDenoiser::operator()(
   const GreyscaleImage& image)
 {
-  this->replace_pixel_edges(image);
+  this->validate_size(image.height(), image.width());
+  this->resize_channels(1, 1);
 
-  auto&& edge_capacity_map = boost::get(boost::edge_capacity, this->graph);
-  auto&& edge_residual_capacity_map = boost::get(
-    boost::edge_residual_capacity, this->graph
-  );
-  auto&& edge_reverse_map = boost::get(boost::edge_reverse, this->graph);
-  auto&& vertex_index_map = boost::get(boost::vertex_index, this->graph);
-  auto&& vertex_distance_map = boost::get(boost::vertex_distance, this->graph);
-  auto&& vertex_predecessor_map = boost::get(
-    boost::vertex_predecessor, this->graph
+  this->denoise_channel(
+    [&image](const ImageSize y, const ImageSize x)
+    {
+      return image(y, x);
+    },
+    this->channels.front(),
+    this->labels.front()
   );
-  auto&& vertex_colour_map = boost::get(boost::vertex_color, this->graph);
+  this->update_peak_memory();
+}
 
-  boost::boykov_kolmogorov_max_flow(
-    this->graph,
-    edge_capacity_map,
-    edge_residual_capacity_map,
-    edge_reverse_map,
-    vertex_predecessor_map,
-    vertex_colour_map,
-    vertex_distance_map,
-    vertex_index_map,
-    this->source,
-    this->sink
+void BinaryImageDenoiser::MaxFlowDenoiser::operator()(
+  const MultiChannelImage& image)
+{
+  this->validate_size(image.height(), image.width());
+  this->resize_channels(
+    image.channels(),
+    fit_channels(
+      this->options.memory_budget, this->estimate_memory(), image.channels()
+    )
   );
+
+  // The topology is shared read-only,
+  // so each solver only touches its own state
+  // and the labels of its own channels.
+  // If the memory budget does not allow a state per channel,
+  // each solver handles every solvers_count-th channel in turn.
+  const std::size_t solvers_count = this->channels.size();
+  std::vector<std::future<void>> solutions;
+  solutions.reserve(solvers_count);
+  for (std::size_t solver_index = 0; solver_index < solvers_count;
+       ++solver_index)
+  {
+    solutions.push_back(std::async(
+      std::launch::async,
+      [this, &image, solver_index, solvers_count]
+      {
+        auto& channel = this->channels[solver_index];
+        for (std::size_t channel_index = solver_index;
+             channel_index < this->labels.size();
+             channel_index += solvers_count)
+        {
+          this->denoise_channel(
+            [&image, channel_index](const ImageSize y, const ImageSize x)
+            {
+              return image(y, x, static_cast<PixelValue>(channel_index));
+            },
+            channel,
+            this->labels[channel_index]
+          );
+        }
+      }
+    ));
+  }
+  for (auto& solution : solutions)
+  {
+    solution.get();
+  }
+  this->update_peak_memory();
 }
 
 void
 BinaryImageDenoiser::MaxFlowDenoiser::operator>>(GreyscaleImage& output_image) const
 {
-  auto&& colours = boost::get(boost::vertex_color, this->graph);
-
-  auto&& source_colour = colours[this->source_index];
-  auto&& sink_colour = colours[this->sink_index];
-  if (source_colour != boost::black_color)
+  if (this->labels.size() != 1)
   {
     throw ResultConsistencyException{
-      "Source is not black but "s + std::to_string(source_colour)
+      "Expected a single solved channel but got "s +
+      std::to_string(this->labels.size())
     };
   }
-  if (source_colour == sink_colour)
+  this->extract(
+    this->labels.front(),
+    [&output_image](const ImageSize y, const ImageSize x, const PixelValue value)
+    {
+      output_image(y, x) = value;
+    }
+  );
+}
+
+void BinaryImageDenoiser::MaxFlowDenoiser::operator>>(
+  MultiChannelImage& output_image) const
+{
+  if (this->labels.size() != output_image.channels())
   {
     throw ResultConsistencyException{
-      "Source and sink have the same colour "s + std::to_string(source_colour)
+      "Expected "s + std::to_string(output_image.channels()) +
+      " solved channels but got "s + std::to_string(this->labels.size())
     };
   }
+  for (PixelValue channel_index = 0; channel_index < this->labels.size();
+       ++channel_index)
+  {
+    this->extract(
+      this->labels[channel_index],
+      [&output_image, channel_index](
+        const ImageSize y, const ImageSize x, const PixelValue value)
+      {
+        output_image(y, x, channel_index) = value;
+      }
+    );
+  }
+}
+
+std::size_t BinaryImageDenoiser::MaxFlowDenoiser::estimate_solver_memory_size(
+  const TopologySize& size)
+{
+  return size.edges * (sizeof(EdgeCapacity) + sizeof(EdgeCapacity)) +
+         static_cast<std::size_t>(size.vertices) *
+         (sizeof(boost::default_color_type) + sizeof(VertexCount) +
+          sizeof(EdgeDescriptor)) +
+         max_flow_memory_size(size.vertices);
+}
+
+std::size_t BinaryImageDenoiser::MaxFlowDenoiser::estimate_labels_memory_size(
+  const TopologySize& size)
+{
+  return bit_vector_memory_size(size.vertices);
+}
+
+PixelValue BinaryImageDenoiser::MaxFlowDenoiser::fit_channels(
+  const std::optional<std::size_t>& memory_budget,
+  const MemoryEstimate& estimate,
+  const PixelValue channels_count)
+{
+  if (!memory_budget)
+  {
+    return channels_count;
+  }
 
-  for (ImageSize y = 0; y < this->rows; ++y)
+  // The topology and the labels of every channel are needed anyway,
+  // and each channel solved in parallel adds a solver state.
+  const auto& required_memory =
+    estimate.topology + channels_count * estimate.labels;
+  if (required_memory + estimate.solver > *memory_budget)
   {
-    for (ImageSize x = 0; x < this->columns; ++x)
-    {
-      output_image(y, x) = colours[y * this->columns + x] == boost::black_color
-                           ? std::numeric_limits<PixelValue>::max()
-                           : 0x00;
-    }
+    throw MemoryBudgetException{
+      "Denoising "s + std::to_string(channels_count) +
+      " channel(s) requires at least "s +
+      std::to_string(required_memory + estimate.solver) +
+      " bytes, but the memory budget is "s + std::to_string(*memory_budget) +
+      " bytes"s
+    };
   }
+  return static_cast<PixelValue>(std::min<std::size_t>(
+    channels_count, (*memory_budget - required_memory) / estimate.solver
+  ));
 }
 
-BinaryImageDenoiser::MaxFlowDenoiser::MaxFlowDenoiser(
+GridTopology BinaryImageDenoiser::MaxFlowDenoiser::construct_topology(
   const ImageSize height,
   const ImageSize width,
-  const EdgeCapacity discontinuity_penalty,
-  const VertexCount vertices_count)
-  : rows{height}
-  , columns{width}
-  , source_index{vertices_count - 2}
-  , sink_index{vertices_count - 1}
-  , graph{construct_graph(vertices_count)}
-  , source{boost::vertex(this->source_index, this->graph)}
-  , sink{boost::vertex(this->sink_index, this->graph)}
+  const std::vector<bool>& mask) const
 {
-  this->add_edges(discontinuity_penalty);
+  // Refuse an over-budget graph before allocating any of it.
+  fit_channels(
+    this->options.memory_budget,
+    estimate_memory(height, width, mask),
+    1
+  );
+  // Collapsed channels build their own edges.
+  return {
+    height,
+    width,
+    order_pixels(height, width, this->options.vertex_ordering, mask),
+    !this->options.collapse_fixed_regions
+  };
 }
 
-BinaryImageDenoiser::MaxFlowDenoiser::Graph
-BinaryImageDenoiser::MaxFlowDenoiser::construct_graph(const VertexCount vertices_count)
+MemoryEstimate BinaryImageDenoiser::MaxFlowDenoiser::estimate_memory() const
 {
-  if (this->source_index < static_cast<VertexCount>(this->rows) * this->columns)
+  const auto& size = this->topology.size();
+  return {
+    .topology = this->topology.memory_size() +
+                (this->topology.has_edges()
+                 ? 0
+                 : GridTopology::estimate_edges_memory_size(size)),
+    .solver = estimate_solver_memory_size(size),
+    .labels = estimate_labels_memory_size(size),
+  };
+}
+
+BinaryImageDenoiser::MaxFlowDenoiser::ChannelState
+BinaryImageDenoiser::MaxFlowDenoiser::construct_channel(
+  std::unique_ptr<const GridTopology> collapsed_topology) const
+{
+  ChannelState channel;
+  channel.collapsed_topology = std::move(collapsed_topology);
+  const auto& topology = this->channel_topology(channel);
+  const auto& vertices_count = num_vertices(topology);
+  channel.capacities = std::vector<EdgeCapacity>(num_edges(topology));
+  channel.residual_capacities = std::vector<EdgeCapacity>(num_edges(topology));
+  channel.colours = std::vector<boost::default_color_type>(vertices_count);
+  channel.distances = std::vector<VertexCount>(vertices_count);
+  channel.predecessors = std::vector<EdgeDescriptor>(vertices_count);
+
+  for (auto [ei, ei_end] = edges(topology); ei != ei_end; ++ei)
   {
-    throw EdgeInitialisationException{
-      "Source index "s + std::to_string(this->source_index) +
-      " is less than number of pixels "s +
-      std::to_string(this->rows * this->columns) +
-      " but it must follow the last pixel"
-    };
+    const EdgeDescriptor& edge = *ei;
+    const auto& edge_source = source(edge, topology);
+    const auto& edge_target = target(edge, topology);
+    if (edge_source == topology.sink() or
+        edge_source == topology.source() or
+        edge_target == topology.sink() or
+        edge_target == topology.source())
+    {
+      channel.capacities[edge.index] = 0;
+    }
+    else
+    {
+      channel.capacities[edge.index] = this->discontinuity_penalty;
+    }
   }
 
-  if (this->sink_index <= this->source_index)
+  channel.peak_memory_size = this->memory_size(channel);
+  return channel;
+}
+
+const GridTopology& BinaryImageDenoiser::MaxFlowDenoiser::channel_topology(
+  const ChannelState& channel) const
+{
+  if (channel.collapsed_topology)
   {
-    throw EdgeInitialisationException{
-      "Sink index "s + std::to_string(this->sink_index) +
-      " is less than or equal to the source index "s +
-      std::to_string(this->source_index) + " but it must follow the source"
-    };
+    return *channel.collapsed_topology;
   }
-  if (this->sink_index + 1 != vertices_count)
+  return this->topology.has_edges() ? this->topology : *this->whole_topology;
+}
+
+void BinaryImageDenoiser::MaxFlowDenoiser::resize_channels(
+  const PixelValue channels_count, const PixelValue solvers_count)
+{
+  if (channels_count == 0)
   {
-    throw EdgeInitialisationException{
-      "Sink index "s + std::to_string(this->sink_index) +
-      " must be the last vertex index "s + std::to_string(vertices_count - 1)
-    };
+    throw EdgeInitialisationException{"Input image has no channels"s};
   }
+  this->labels.resize(channels_count);
+  for (auto& channel_labels : this->labels)
+  {
+    channel_labels.resize(num_vertices(this->topology));
+  }
+  if (this->channels.size() > solvers_count)
+  {
+    this->channels.resize(solvers_count);
+  }
+  // Collapsed channels get their states when their topologies are known.
+  while (this->channels.size() < solvers_count)
+  {
+    this->channels.push_back(
+      this->options.collapse_fixed_regions
+      ? ChannelState{}
+      : this->construct_channel(nullptr)
+    );
+  }
+  this->update_peak_memory();
+}
 
-  std::vector<std::pair<VertexCount, VertexCount>> edges;
-  const EdgeCount edge_count =
-    4 * (this->rows - 1) * (this->columns - 1) + 2 * (this->rows - 1) +
-    2 * (this->columns - 1) + 4 * this->rows * this->columns;
-  edges.reserve(edge_count);
-
-  for (ImageSize y = 0; y < this->rows; ++y)
+std::size_t BinaryImageDenoiser::MaxFlowDenoiser::memory_size(
+  const ChannelState& channel) const
+{
+  if (channel.colours.empty())
   {
-    for (ImageSize x = 0; x < this->columns; ++x)
-    {
-      const auto&& current_vertex = y * this->columns + x;
-      if (x + 1 < this->columns)
-      {
-        edges.emplace_back(current_vertex, current_vertex + 1);
-      }
-      if (x > 0)
-      {
-        edges.emplace_back(current_vertex, current_vertex - 1);
-      }
-      if (y + 1 < this->rows)
-      {
-        edges.emplace_back(current_vertex, current_vertex + this->columns);
-      }
-      if (y > 0)
-      {
-        edges.emplace_back(current_vertex, current_vertex - this->columns);
-      }
+    return 0;
+  }
+  return (channel.collapsed_topology
+          ? channel.collapsed_topology->memory_size()
+          : 0) +
+         channel.capacities.capacity() * sizeof(EdgeCapacity) +
+         channel.residual_capacities.capacity() * sizeof(EdgeCapacity) +
+         channel.colours.capacity() * sizeof(boost::default_color_type) +
+         channel.distances.capacity() * sizeof(VertexCount) +
+         channel.predecessors.capacity() * sizeof(EdgeDescriptor) +
+         max_flow_memory_size(num_vertices(this->channel_topology(channel)));
+}
 
-      edges.emplace_back(current_vertex, this->source_index);
-      edges.emplace_back(current_vertex, this->sink_index);
-    }
+void BinaryImageDenoiser::MaxFlowDenoiser::update_peak_memory()
+{
+  // Each channel state tracks its own peak,
+  // since the states are reallocated by parallel solvers.
+  std::size_t memory_size =
+    this->topology.memory_size() +
+    (this->whole_topology ? this->whole_topology->memory_size() : 0);
+  for (const auto& channel : this->channels)
+  {
+    memory_size += channel.peak_memory_size;
   }
+  for (const auto& channel_labels : this->labels)
+  {
+    memory_size += bit_vector_memory_size(channel_labels.capacity());
+  }
+  this->peak_memory_size = std::max(this->peak_memory_size, memory_size);
+}
 
-  for (ImageSize y = 0; y < this->rows; ++y)
+void BinaryImageDenoiser::MaxFlowDenoiser::validate_size(
+  const ImageSize height, const ImageSize width) const
+{
+  if (this->topology.height() != height)
   {
-    for (ImageSize x = 0; x < this->columns; ++x)
-    {
-      edges.emplace_back(this->source_index, y * this->columns + x);
-    }
+    throw EdgeInitialisationException{
+      "Wrong input image height. Expected "s +
+      std::to_string(this->topology.height()) +
+      ", actual "s + std::to_string(height)
+    };
   }
-  for (ImageSize y = 0; y < this->rows; ++y)
+  if (this->topology.width() != width)
   {
-    for (ImageSize x = 0; x < this->columns; ++x)
-    {
-      edges.emplace_back(this->sink_index, y * this->columns + x);
-    }
+    throw EdgeInitialisationException{
+      "Wrong input image width. Expected "s +
+      std::to_string(this->topology.width()) +
+      ", actual "s + std::to_string(width)
+    };
   }
+}
 
-  return {
-    boost::edges_are_sorted, edges.cbegin(), edges.cend(), vertices_count,
-  };
+template <typename PixelReader>
+void BinaryImageDenoiser::MaxFlowDenoiser::denoise_channel(
+  const PixelReader& read_pixel,
+  ChannelState& channel,
+  std::vector<bool>& channel_labels) const
+{
+  if (this->options.collapse_fixed_regions)
+  {
+    this->collapse_fixed_regions(read_pixel, channel);
+  }
+  this->replace_pixel_edges(read_pixel, channel);
+  this->solve(channel);
+  this->store_labels(read_pixel, channel, channel_labels);
 }
 
-void BinaryImageDenoiser::MaxFlowDenoiser::add_edges(
-  const EdgeCapacity discontinuity_penalty)
+template <typename PixelReader>
+void BinaryImageDenoiser::MaxFlowDenoiser::collapse_fixed_regions(
+  const PixelReader& read_pixel, ChannelState& channel) const
 {
-  const auto& edges_capacity_map = boost::get(
-    boost::edge_capacity, this->graph
-  );
-  const auto& edge_reverse_map = boost::get(boost::edge_reverse, this->graph);
-  for (auto [ei, ei_end] = boost::edges(this->graph); ei != ei_end; ++ei)
+  const auto& rows = this->topology.height();
+  const auto& columns = this->topology.width();
+
+  // Release the state of the previous image first.
+  std::size_t peak_memory_size = channel.peak_memory_size;
+  channel = ChannelState{};
+
+  // Collapsing must not need more memory than the solver state
+  // of the whole graph, which is what the memory estimate charges
+  // for each channel.
+  const auto& channel_memory_size = this->estimate_memory().solver;
+  std::unique_ptr<const GridTopology> collapsed_topology;
+  if (estimate_fixed_regions_memory_size(rows, columns) <= channel_memory_size)
   {
-    const auto& edge_source = boost::source(*ei, this->graph);
-    const auto& edge_target = boost::target(*ei, this->graph);
-    if (edge_source == this->sink or edge_source == this->source or
-        edge_target == this->sink or edge_target == this->source)
+    std::vector<bool> unfixed_pixels;
     {
-      edges_capacity_map[*ei] = 0;
-    }
-    else
-    {
-      edges_capacity_map[*ei] = discontinuity_penalty;
+      std::vector<PixelValue> pixels(static_cast<VertexCount>(rows) * columns);
+      for (ImageSize y = 0; y < rows; ++y)
+      {
+        for (ImageSize x = 0; x < columns; ++x)
+        {
+          pixels[static_cast<VertexCount>(y) * columns + x] = read_pixel(y, x);
+        }
+      }
+      unfixed_pixels = find_unfixed_pixels(
+        this->topology, this->discontinuity_penalty, pixels
+      );
     }
+    peak_memory_size = std::max(
+      peak_memory_size, estimate_fixed_regions_memory_size(rows, columns)
+    );
 
-    // Set reverse edge
-    if (edge_source > boost::target(*ei, this->graph))
+    // Fixed pixels get no vertices and keep their binarised values,
+    // so they act as the unmasked pixels of the shared topology.
+    const auto& size = GridTopology::measure(rows, columns, unfixed_pixels);
+    if (GridTopology::estimate_memory_size(rows, columns, size) +
+        estimate_solver_memory_size(size) <= channel_memory_size)
     {
-      const auto& [reverse_edge, reverse_edge_exists] = boost::edge(
-        edge_target, edge_source, this->graph
+      collapsed_topology = std::make_unique<const GridTopology>(
+        rows,
+        columns,
+        order_pixels(
+          rows, columns, this->options.vertex_ordering, unfixed_pixels
+        )
       );
-      if (!reverse_edge_exists)
+    }
+  }
+
+  // Otherwise, the whole graph is solved.
+  // Its edges are built once over the shared numbering
+  // and shared by all channels that cannot be collapsed.
+  if (!collapsed_topology and !this->topology.has_edges())
+  {
+    std::call_once(
+      this->whole_topology_built,
+      [this, rows, columns]
       {
-        throw EdgeInitialisationException{
-          "Edge from vertex "s +
-          std::to_string(boost::target(*ei, this->graph)) + " to vertex "s +
-          std::to_string(edge_source) + " does not exist in reverse edges list"s
-        };
+        this->whole_topology = std::make_unique<const GridTopology>(
+          rows, columns, this->topology.numbering()
+        );
       }
-      edge_reverse_map[*ei] = reverse_edge;
-      edge_reverse_map[reverse_edge] = *ei;
-    }
+    );
   }
+  channel = this->construct_channel(std::move(collapsed_topology));
+  channel.peak_memory_size = std::max(
+    peak_memory_size, channel.peak_memory_size
+  );
 }
 
+template <typename PixelReader>
 void BinaryImageDenoiser::MaxFlowDenoiser::replace_pixel_edges(
-  const GreyscaleImage& image)
+  const PixelReader& read_pixel, ChannelState& channel) const
 {
-  if (this->rows != image.height())
+  const auto& topology = this->channel_topology(channel);
+  const auto& rows = topology.height();
+  const auto& columns = topology.width();
+  for (ImageSize y = 0; y < rows; ++y)
   {
-    throw EdgeInitialisationException{
-      "Wrong input image height. Expected "s + std::to_string(this->rows) +
-      ", actual "s + std::to_string(image.height())
-    };
-  }
-  if (this->columns != image.width())
-  {
-    throw EdgeInitialisationException{
-      "Wrong input image width. Expected "s + std::to_string(this->columns) +
-      ", actual "s + std::to_string(image.width())
-    };
-  }
-  for (ImageSize y = 0; y < this->rows; ++y)
-  {
-    for (ImageSize x = 0; x < this->columns; ++x)
+    for (ImageSize x = 0; x < columns; ++x)
     {
+      const auto& vertex = topology.pixel_vertex(y, x);
+      if (vertex == no_vertex)
       {
-        const auto& [reverse_edge_descriptor, reverse_edge_exists] = boost::edge(
-          boost::vertex(y * this->columns + x, this->graph),
-          this->source,
-          this->graph
-        );
+        continue;
+      }
+
+      const PixelValue pixel = read_pixel(y, x);
+      EdgeCapacity source_capacity = pixel;
+      EdgeCapacity sink_capacity =
+        std::numeric_limits<PixelValue>::max() - pixel;
+
+      // Unmasked and collapsed neighbours keep their binarised labels,
+      // so a disagreement with them is paid through the terminal edges.
+      const auto& add_fixed_neighbour =
+        [&](const ImageSize neighbour_y, const ImageSize neighbour_x)
+        {
+          if (topology.pixel_vertex(neighbour_y, neighbour_x) != no_vertex)
+          {
+            return;
+          }
+          if (read_pixel(neighbour_y, neighbour_x) >
+              std::numeric_limits<PixelValue>::max() / 2)
+          {
+            source_capacity += this->discontinuity_penalty;
+          }
+          else
+          {
+            sink_capacity += this->discontinuity_penalty;
+          }
+        };
+      if (x + 1 < columns)
+      {
+        add_fixed_neighbour(y, x + 1);
+      }
+      if (x > 0)
+      {
+        add_fixed_neighbour(y, x - 1);
+      }
+      if (y + 1 < rows)
+      {
+        add_fixed_neighbour(y + 1, x);
+      }
+      if (y > 0)
+      {
+        add_fixed_neighbour(y - 1, x);
+      }
+
+      {
+        const auto& [reverse_edge_descriptor, reverse_edge_exists] =
+          topology.edge(vertex, topology.source());
         if (!reverse_edge_exists)
         {
           throw EdgeInitialisationException{
@@ -257,16 +564,14 @@ void BinaryImageDenoiser::MaxFlowDenoiser::replace_pixel_edges(
             std::to_string(x) + ") to source does not exist"s
           };
         }
-        const auto& edge_descriptor = boost::get(
-          boost::edge_reverse, this->graph
-        )[reverse_edge_descriptor];
-        boost::get(boost::edge_capacity, graph)[edge_descriptor] = image(y, x);
+        const auto& edge_descriptor = topology.reverse(
+          reverse_edge_descriptor
+        );
+        channel.capacities[edge_descriptor.index] = source_capacity;
       }
       {
-        const auto& [edge_descriptor, edge_exists] = boost::edge(
-          boost::vertex(y * this->columns + x, this->graph),
-          this->sink,
-          this->graph
+        const auto& [edge_descriptor, edge_exists] = topology.edge(
+          vertex, topology.sink()
         );
         if (!edge_exists)
         {
@@ -275,9 +580,130 @@ void BinaryImageDenoiser::MaxFlowDenoiser::replace_pixel_edges(
             std::to_string(x) + ") to sink does not exist"s
           };
         }
-        boost::get(boost::edge_capacity, graph)[edge_descriptor] =
-          std::numeric_limits<PixelValue>::max() - image(y, x);
+        channel.capacities[edge_descriptor.index] = sink_capacity;
       }
     }
   }
 }
+
+void BinaryImageDenoiser::MaxFlowDenoiser::solve(ChannelState& channel) const
+{
+  const auto& topology = this->channel_topology(channel);
+  const auto& edge_index_map = boost::make_function_property_map<
+    EdgeDescriptor
+  >(
+    [](const EdgeDescriptor& edge)
+    {
+      return edge.index;
+    }
+  );
+  const auto& vertex_index_map =
+    boost::typed_identity_property_map<VertexCount>{};
+
+  boost::boykov_kolmogorov_max_flow(
+    topology,
+    boost::make_iterator_property_map(
+      channel.capacities.begin(), edge_index_map
+    ),
+    boost::make_iterator_property_map(
+      channel.residual_capacities.begin(), edge_index_map
+    ),
+    boost::make_function_property_map<EdgeDescriptor>(
+      [&topology](const EdgeDescriptor& edge)
+      {
+        return topology.reverse(edge);
+      }
+    ),
+    boost::make_iterator_property_map(
+      channel.predecessors.begin(), vertex_index_map
+    ),
+    boost::make_iterator_property_map(
+      channel.colours.begin(), vertex_index_map
+    ),
+    boost::make_iterator_property_map(
+      channel.distances.begin(), vertex_index_map
+    ),
+    vertex_index_map,
+    topology.source(),
+    topology.sink()
+  );
+}
+
+template <typename PixelReader>
+void BinaryImageDenoiser::MaxFlowDenoiser::store_labels(
+  const PixelReader& read_pixel,
+  const ChannelState& channel,
+  std::vector<bool>& channel_labels) const
+{
+  const auto& topology = this->channel_topology(channel);
+  const auto& source_colour = channel.colours[topology.source()];
+  const auto& sink_colour = channel.colours[topology.sink()];
+  if (source_colour != boost::black_color)
+  {
+    throw ResultConsistencyException{
+      "Source is not black but "s + std::to_string(source_colour)
+    };
+  }
+  if (source_colour == sink_colour)
+  {
+    throw ResultConsistencyException{
+      "Source and sink have the same colour "s + std::to_string(source_colour)
+    };
+  }
+
+  if (!channel.collapsed_topology)
+  {
+    for (VertexCount vertex = 0; vertex < num_vertices(topology); ++vertex)
+    {
+      channel_labels[vertex] = channel.colours[vertex] == boost::black_color;
+    }
+    return;
+  }
+
+  // Collapsed pixels keep their binarised values.
+  const auto& rows = this->topology.height();
+  const auto& columns = this->topology.width();
+  for (ImageSize y = 0; y < rows; ++y)
+  {
+    for (ImageSize x = 0; x < columns; ++x)
+    {
+      const auto& vertex = this->topology.pixel_vertex(y, x);
+      if (vertex == no_vertex)
+      {
+        continue;
+      }
+      const auto& collapsed_vertex = topology.pixel_vertex(y, x);
+      channel_labels[vertex] =
+        collapsed_vertex == no_vertex
+        ? read_pixel(y, x) > std::numeric_limits<PixelValue>::max() / 2
+        : channel.colours[collapsed_vertex] == boost::black_color;
+    }
+  }
+}
+
+template <typename PixelWriter>
+void BinaryImageDenoiser::MaxFlowDenoiser::extract(
+  const std::vector<bool>& channel_labels,
+  const PixelWriter& write_pixel) const
+{
+  const auto& rows = this->topology.height();
+  const auto& columns = this->topology.width();
+  for (ImageSize y = 0; y < rows; ++y)
+  {
+    for (ImageSize x = 0; x < columns; ++x)
+    {
+      const auto& vertex = this->topology.pixel_vertex(y, x);
+      if (vertex == no_vertex)
+      {
+        continue;
+      }
+      write_pixel(
+        y,
+        x,
+        channel_labels[vertex]
+        ? std::numeric_limits<PixelValue>::max()
+        : PixelValue{0x00}
+      );
+    }
+  }
+}
@@ -4,12 +4,19 @@
 #include "binary_image_denoiser.hpp"
 
 #include "greyscale_image.hpp"
+#include "grid_topology.hpp"
+#include "multi_channel_image.hpp"
 #include "types.hpp"
 
-#include <boost/graph/adjacency_list.hpp>
-#include <boost/graph/compressed_sparse_row_graph.hpp>
 #include <boost/graph/boykov_kolmogorov_max_flow.hpp>
 
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
 /// \class MaxFlowDenoiser
 /// \brief Class for denoising greyscale images
 /// using the Boykov-Kolmogorov Max-Flow algorithm.
@@ -20,6 +27,22 @@
 /// from The Graph Boost Library (BGL).
 /// It constructs a graph based on the
 /// given image and computes the maximum flow to determine the denoised image.
+///
+/// The graph topology (vertex offsets, edge targets, and reverse edges)
+/// does not depend on the image, so it is built once
+/// and shared by all image channels.
+/// It can also be saved to a file and memory-mapped by other processes.
+/// Each channel being solved owns its edge capacities and the solver state,
+/// and each solved channel owns its labels.
+///
+/// Optionally, the regions with provably fixed labels are collapsed
+/// into the source and the sink for each channel.
+/// The channel then gets its own, smaller topology of the remaining pixels,
+/// and only the pixel numbering of the shared topology is built.
+/// Channels that cannot be collapsed within the memory of the whole graph
+/// solve the whole graph instead.
+/// Its edges are built once over the shared numbering
+/// and shared by all such channels.
 class BinaryImageDenoiser::MaxFlowDenoiser
 {
 public:
@@ -30,13 +53,54 @@ public:
   /// \param width The input image(s) width.
   /// \param discontinuity_penalty A smoothness term for the denoising problem,
   /// which is a weight of edges between the neighbouring pixels.
+  /// \param options The tuning options of the solver.
+  /// \param mask Whether each pixel, indexed by y * width + x,
+  /// should be denoised. An empty mask selects all pixels.
+  /// Pixels outside the mask get no vertices
+  /// and keep their labels during denoising.
   MaxFlowDenoiser(
-    ImageSize height, ImageSize width, EdgeCapacity discontinuity_penalty);
+    ImageSize height,
+    ImageSize width,
+    EdgeCapacity discontinuity_penalty,
+    const DenoiserOptions& options,
+    const std::vector<bool>& mask);
+
+  /// \brief Construct a new Max-Flow solver
+  /// on a topology memory-mapped from a file.
+  ///
+  /// \param topology_path The path to a file
+  /// written by MaxFlowDenoiser::save_topology.
+  /// \param discontinuity_penalty A smoothness term for the denoising problem,
+  /// which is a weight of edges between the neighbouring pixels.
+  /// \param options The tuning options of the solver.
+  /// The vertex ordering only applies to collapsed graphs.
+  MaxFlowDenoiser(
+    const std::filesystem::path& topology_path,
+    EdgeCapacity discontinuity_penalty,
+    const DenoiserOptions& options);
+
+  /// \brief Write the graph topology to a file.
+  ///
+  /// \param path The path to the topology file.
+  void save_topology(const std::filesystem::path& path) const;
+
+  /// \brief Estimate the memory needed to denoise images
+  /// without building the graph.
+  ///
+  /// \param height The input image(s) height.
+  /// \param width The input image(s) width.
+  /// \param mask Whether each pixel, indexed by y * width + x,
+  /// should be denoised. An empty mask selects all pixels.
+  [[nodiscard]] static MemoryEstimate estimate_memory(
+    ImageSize height, ImageSize width, const std::vector<bool>& mask);
+
+  /// \brief Get the peak memory allocated since the construction, in bytes.
+  [[nodiscard]] std::size_t peak_memory() const;
 
   /// \brief Apply the denoising algorithm to the given noisy image.
   ///
   /// \description
-  /// The results are stored in the MaxFlowDenoiser::graph.
+  /// The results are stored in the labels of the first channel.
   /// To fetch the denoised image, use MaxFlowDenoiser::operator>>.
   ///
   /// \param noisy_image The input noisy image.
@@ -44,6 +108,18 @@ public:
   /// specified during the solver construction.
   void operator()(const GreyscaleImage& noisy_image);
 
+  /// \brief Apply the denoising algorithm to each channel of the given image.
+  ///
+  /// \description
+  /// The channels are solved in parallel on the shared graph topology,
+  /// as many at once as the memory budget allows.
+  /// To fetch the denoised image, use MaxFlowDenoiser::operator>>.
+  ///
+  /// \param noisy_image The input noisy image.
+  /// It must have the same height and width
+  /// specified during the solver construction.
+  void operator()(const MultiChannelImage& noisy_image);
+
   /// @brief Extract the denoised image.
   ///
   /// @note
@@ -52,75 +128,127 @@ public:
   /// \param output_image The image to store the result in.
   void operator>>(GreyscaleImage& output_image) const;
 
+  /// @brief Extract the denoised multi-channel image.
+  ///
+  /// @note
+  /// You must use the MaxFlowDenoiser::operator() to denoise an image
+  /// with the same number of channels first.
+  ///
+  /// \param output_image The image to store the result in.
+  void operator>>(MultiChannelImage& output_image) const;
+
 private:
-  using EdgeDescriptor = boost::detail::csr_edge_descriptor<
-    VertexCount,
-    EdgeCount
-  >;
-
-  using VIndexProperty = boost::property<boost::vertex_index_t, VertexCount>;
-  using VDistanceProperty = boost::property<
-    boost::vertex_distance_t,
-    VertexCount,
-    VIndexProperty
-  >;
-  using VPredecessorProperty = boost::property<
-    boost::vertex_predecessor_t,
-    EdgeDescriptor,
-    VDistanceProperty
-  >;
-  using VColourProperty = boost::property<
-    boost::vertex_color_t,
-    boost::default_color_type,
-    VPredecessorProperty
-  >;
-  using VertexProperties = VColourProperty;
-
-  using EReverse = boost::property<boost::edge_reverse_t, EdgeDescriptor>;
-  using ECapacity = boost::property<
-    boost::edge_capacity_t,
-    EdgeCapacity,
-    EReverse
-  >;
-  using EResidual = boost::property<
-    boost::edge_residual_capacity_t,
-    EdgeCapacity,
-    ECapacity
-  >;
-  using EdgeProperties = EResidual;
-
-  using Graph = boost::compressed_sparse_row_graph<
-    boost::directedS,
-    VertexProperties,
-    EdgeProperties,
-    boost::no_property,
-    VertexCount,
-    EdgeCount
-  >;
-  using VertexDescriptor = boost::graph_traits<Graph>::vertex_descriptor;
+  using EdgeDescriptor = boost::graph_traits<GridTopology>::edge_descriptor;
 
-  MaxFlowDenoiser(
+  /// \brief Edge capacities and Max-Flow state of a single image channel.
+  ///
+  /// \details
+  /// Edge properties are indexed by the edge index
+  /// and vertex properties are indexed by the vertex index
+  /// of the channel topology:
+  /// the collapsed topology if there is one,
+  /// or the shared MaxFlowDenoiser::topology otherwise.
+  struct ChannelState
+  {
+    /// \brief Topology of the pixels left after collapsing fixed regions,
+    /// or empty if the channel solves the whole graph.
+    std::unique_ptr<const GridTopology> collapsed_topology;
+    std::vector<EdgeCapacity> capacities;
+    std::vector<EdgeCapacity> residual_capacities;
+    std::vector<boost::default_color_type> colours;
+    std::vector<VertexCount> distances;
+    std::vector<EdgeDescriptor> predecessors;
+    /// \brief Peak bytes allocated for the channel.
+    std::size_t peak_memory_size = 0;
+  };
+
+  /// \brief Estimate the bytes of the solver state of a channel,
+  /// including the working arrays of the Max-Flow algorithm.
+  [[nodiscard]] static std::size_t estimate_solver_memory_size(
+    const TopologySize& size);
+
+  /// \brief Estimate the bytes of the labels of a solved channel.
+  [[nodiscard]] static std::size_t estimate_labels_memory_size(
+    const TopologySize& size);
+
+  /// \brief Get the number of channels that can be solved in parallel
+  /// within the memory budget.
+  ///
+  /// \throws MemoryBudgetException
+  /// If even a single channel cannot be solved within the budget.
+  static PixelValue fit_channels(
+    const std::optional<std::size_t>& memory_budget,
+    const MemoryEstimate& estimate,
+    PixelValue channels_count);
+
+  [[nodiscard]] GridTopology construct_topology(
     ImageSize height,
     ImageSize width,
-    EdgeCapacity discontinuity_penalty,
-    VertexCount vertices_count);
+    const std::vector<bool>& mask) const;
+
+  [[nodiscard]] MemoryEstimate estimate_memory() const;
+
+  [[nodiscard]] ChannelState construct_channel(
+    std::unique_ptr<const GridTopology> collapsed_topology) const;
+
+  [[nodiscard]] const GridTopology& channel_topology(
+    const ChannelState& channel) const;
+
+  void resize_channels(PixelValue channels_count, PixelValue solvers_count);
+
+  [[nodiscard]] std::size_t memory_size(const ChannelState& channel) const;
+
+  void update_peak_memory();
+
+  void validate_size(ImageSize height, ImageSize width) const;
+
+  template <typename PixelReader>
+  void denoise_channel(
+    const PixelReader& read_pixel,
+    ChannelState& channel,
+    std::vector<bool>& channel_labels) const;
+
+  template <typename PixelReader>
+  void collapse_fixed_regions(
+    const PixelReader& read_pixel, ChannelState& channel) const;
+
+  template <typename PixelReader>
+  void replace_pixel_edges(
+    const PixelReader& read_pixel, ChannelState& channel) const;
+
+  void solve(ChannelState& channel) const;
+
+  template <typename PixelReader>
+  void store_labels(
+    const PixelReader& read_pixel,
+    const ChannelState& channel,
+    std::vector<bool>& channel_labels) const;
+
+  template <typename PixelWriter>
+  void extract(
+    const std::vector<bool>& channel_labels,
+    const PixelWriter& write_pixel) const;
+
+  const EdgeCapacity discontinuity_penalty;
 
-  Graph construct_graph(VertexCount vertices_count);
+  const DenoiserOptions options;
 
-  void add_edges(EdgeCapacity discontinuity_penalty);
+  const GridTopology topology;
 
-  void replace_pixel_edges(const GreyscaleImage& image);
+  /// \brief Edges of the whole graph over the numbering of the shared topology
+  /// if it has no edges, built once for the channels that cannot be collapsed.
+  mutable std::unique_ptr<const GridTopology> whole_topology;
 
-  const ImageSize rows;
-  const ImageSize columns;
+  mutable std::once_flag whole_topology_built;
 
-  const VertexCount source_index;
-  const VertexCount sink_index;
+  /// \brief States of the channels being solved at once.
+  std::vector<ChannelState> channels;
 
-  Graph graph;
+  /// \brief Whether each vertex of the shared topology
+  /// is labelled as a source-side (white) pixel, for each solved channel.
+  std::vector<std::vector<bool>> labels;
 
-  const VertexDescriptor source;
-  const VertexDescriptor sink;
+  std::size_t peak_memory_size = 0;
 };
 
 #endif //MAXFLOW_IMAGE_DENOISING_MAX_FLOW_DENOISER_HPP
@@ -40,4 +40,22 @@ public:
   }
 };
 
+class TopologyFileException : public MaxFlowException
+{
+public:
+  explicit TopologyFileException(std::string message)
+    : MaxFlowException{std::move(message)}
+  {
+  }
+};
+
+class MemoryBudgetException : public MaxFlowException
+{
+public:
+  explicit MemoryBudgetException(std::string message)
+    : MaxFlowException{std::move(message)}
+  {
+  }
+};
+
 #endif //MAXFLOW_IMAGE_DENOISING_MAX_FLOW_EXCEPTIONS_HPP
@@ -0,0 +1,76 @@
+#include "multi_channel_image.hpp"
+
+#include <opencv2/core/mat.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include <limits>
+
+namespace
+{
+  cv::Mat read_8_bit_image(const std::filesystem::path& path)
+  {
+    cv::Mat image = cv::imread(path.string(), cv::IMREAD_UNCHANGED);
+    if (image.depth() == CV_16U)
+    {
+      image.convertTo(
+        image,
+        CV_MAKETYPE(CV_8U, image.channels()),
+        1.0 / (std::numeric_limits<std::uint16_t>::max() /
+               std::numeric_limits<PixelValue>::max())
+      );
+    }
+    else if (image.depth() != CV_8U)
+    {
+      image.convertTo(image, CV_MAKETYPE(CV_8U, image.channels()));
+    }
+    return image;
+  }
+}
+
+MultiChannelImage::MultiChannelImage(const std::filesystem::path& path)
+  : image{std::make_unique<cv::Mat>(read_8_bit_image(path))}
+{
+}
+
+void MultiChannelImage::load(const std::filesystem::path& path)
+{
+  *this->image = read_8_bit_image(path);
+}
+
+void MultiChannelImage::save(const std::filesystem::path& path) const
+{
+  cv::imwrite(path.string(), *this->image);
+}
+
+ImageSize MultiChannelImage::height() const
+{
+  return this->image->rows;
+}
+
+ImageSize MultiChannelImage::width() const
+{
+  return this->image->cols;
+}
+
+PixelValue MultiChannelImage::channels() const
+{
+  return this->image->channels();
+}
+
+PixelValue MultiChannelImage::operator()(
+  ImageSize y, ImageSize x, PixelValue channel) const
+{
+  return this->image->ptr<std::uint8_t>(static_cast<int>(y))[
+    static_cast<std::size_t>(x) * this->image->channels() + channel
+  ];
+}
+
+PixelValue& MultiChannelImage::operator()(
+  ImageSize y, ImageSize x, PixelValue channel)
+{
+  return this->image->ptr<std::uint8_t>(static_cast<int>(y))[
+    static_cast<std::size_t>(x) * this->image->channels() + channel
+  ];
+}
+
+MultiChannelImage::~MultiChannelImage() = default;
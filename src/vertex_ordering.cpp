@@ -0,0 +1,136 @@
+#include "vertex_ordering.hpp"
+
+#include <algorithm>
+
+namespace
+{
+  /// \brief Side of a square tile for VertexOrdering::tiled.
+  /// \details Vertical neighbours within a tile are this many vertices apart,
+  /// so the properties of a few tile rows fit into the L1/L2 caches.
+  constexpr ImageSize tile_side = 64;
+
+  /// \brief Give the pixel the next vertex index if it is selected.
+  void number_pixel(
+    const VertexCount pixel,
+    const std::vector<bool>& mask,
+    VertexCount& vertex,
+    std::vector<VertexCount>& pixel_vertices)
+  {
+    pixel_vertices[pixel] = mask.empty() or mask[pixel] ? vertex++ : no_vertex;
+  }
+
+  void order_rows(
+    const ImageSize height,
+    const ImageSize width,
+    const std::vector<bool>& mask,
+    std::vector<VertexCount>& pixel_vertices)
+  {
+    VertexCount vertex = 0;
+    for (VertexCount pixel = 0; pixel < static_cast<VertexCount>(height) * width;
+         ++pixel)
+    {
+      number_pixel(pixel, mask, vertex, pixel_vertices);
+    }
+  }
+
+  void order_tiles(
+    const ImageSize height,
+    const ImageSize width,
+    const std::vector<bool>& mask,
+    std::vector<VertexCount>& pixel_vertices)
+  {
+    VertexCount vertex = 0;
+    for (VertexCount tile_y = 0; tile_y < height; tile_y += tile_side)
+    {
+      const auto tile_height = std::min<VertexCount>(tile_side, height - tile_y);
+      for (VertexCount tile_x = 0; tile_x < width; tile_x += tile_side)
+      {
+        const auto tile_width = std::min<VertexCount>(tile_side, width - tile_x);
+        for (VertexCount y = tile_y; y < tile_y + tile_height; ++y)
+        {
+          for (VertexCount x = tile_x; x < tile_x + tile_width; ++x)
+          {
+            number_pixel(y * width + x, mask, vertex, pixel_vertices);
+          }
+        }
+      }
+    }
+  }
+
+  /// \brief Number the pixels of a square quadrant along the Z-order curve.
+  /// \details Quadrants lying outside the image are skipped,
+  /// so the resulting indices have no gaps.
+  void order_quadrant(
+    const ImageSize height,
+    const ImageSize width,
+    const VertexCount quadrant_y,
+    const VertexCount quadrant_x,
+    const VertexCount quadrant_side,
+    const std::vector<bool>& mask,
+    VertexCount& vertex,
+    std::vector<VertexCount>& pixel_vertices)
+  {
+    if (quadrant_y >= height or quadrant_x >= width)
+    {
+      return;
+    }
+    if (quadrant_side == 1)
+    {
+      number_pixel(
+        quadrant_y * width + quadrant_x, mask, vertex, pixel_vertices);
+      return;
+    }
+
+    const auto half = quadrant_side / 2;
+    order_quadrant(
+      height, width, quadrant_y, quadrant_x, half, mask, vertex,
+      pixel_vertices);
+    order_quadrant(
+      height, width, quadrant_y, quadrant_x + half, half, mask, vertex,
+      pixel_vertices);
+    order_quadrant(
+      height, width, quadrant_y + half, quadrant_x, half, mask, vertex,
+      pixel_vertices);
+    order_quadrant(
+      height, width, quadrant_y + half, quadrant_x + half, half, mask, vertex,
+      pixel_vertices);
+  }
+
+  void order_z_curve(
+    const ImageSize height,
+    const ImageSize width,
+    const std::vector<bool>& mask,
+    std::vector<VertexCount>& pixel_vertices)
+  {
+    VertexCount side = 1;
+    while (side < height or side < width)
+    {
+      side *= 2;
+    }
+    VertexCount vertex = 0;
+    order_quadrant(height, width, 0, 0, side, mask, vertex, pixel_vertices);
+  }
+}
+
+std::vector<VertexCount> order_pixels(
+  const ImageSize height,
+  const ImageSize width,
+  const VertexOrdering ordering,
+  const std::vector<bool>& mask)
+{
+  std::vector<VertexCount> pixel_vertices(
+    static_cast<VertexCount>(height) * width);
+  switch (ordering)
+  {
+    case VertexOrdering::row_major:
+      order_rows(height, width, mask, pixel_vertices);
+      break;
+    case VertexOrdering::tiled:
+      order_tiles(height, width, mask, pixel_vertices);
+      break;
+    case VertexOrdering::z_order:
+      order_z_curve(height, width, mask, pixel_vertices);
+      break;
+  }
+  return pixel_vertices;
+}
@@ -0,0 +1,29 @@
+#ifndef MAXFLOW_IMAGE_DENOISING_VERTEX_ORDERING_HPP
+#define MAXFLOW_IMAGE_DENOISING_VERTEX_ORDERING_HPP
+
+#include "types.hpp"
+
+#include <limits>
+#include <vector>
+
+/// \brief Vertex index of a pixel that is not a part of the graph.
+constexpr VertexCount no_vertex = std::numeric_limits<VertexCount>::max();
+
+/// \brief Number pixels of an image as graph vertices.
+///
+/// \param height The image height.
+/// \param width The image width.
+/// \param ordering The order in which pixels are numbered.
+/// \param mask Whether each pixel, indexed by y * width + x,
+/// is a part of the graph. An empty mask selects all pixels.
+///
+/// \return The vertex index of each pixel, indexed by y * width + x.
+/// Selected pixels are numbered without gaps starting from zero,
+/// other pixels get no_vertex.
+std::vector<VertexCount> order_pixels(
+  ImageSize height,
+  ImageSize width,
+  VertexOrdering ordering,
+  const std::vector<bool>& mask);
+
+#endif //MAXFLOW_IMAGE_DENOISING_VERTEX_ORDERING_HPP